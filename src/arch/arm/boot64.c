@@ -85,82 +85,99 @@ static void *get_kernel_reloc_addr(uint32_t load_offset, size_t image_size)
 	return 0;
 }
 
+static size_t decompress_kernel(FitImageNode *kernel, void *dst,
+				size_t dst_size)
+{
+	switch (kernel->compression) {
+	case CompressionNone:
+		if (kernel->size > dst_size)
+			return 0;
+		memmove(dst, kernel->data, kernel->size);
+		return kernel->size;
+	case CompressionLzma:
+		return ulzman(kernel->data, kernel->size, dst, dst_size);
+	case CompressionLz4:
+		return ulz4fn(kernel->data, kernel->size, dst, dst_size);
+	default:
+		return 0;
+	}
+}
+
+static const char *compression_name(FitImageNode *kernel)
+{
+	switch (kernel->compression) {
+	case CompressionLzma:
+		return "LZMA";
+	case CompressionLz4:
+		return "LZ4";
+	default:
+		return "uncompressed";
+	}
+}
+
 int boot_arm_linux(void *fdt, FitImageNode *kernel)
 {
 	size_t image_size = 64*MiB;	// default value for pre-3.17 headers
+	Arm64KernelHeader *header = &scratch.header;
+	size_t true_size;
 
-	// Partially decompress to get text_offset. Can't check for errors.
-	scratch.canary = SCRATCH_CANARY_VALUE;
 	switch (kernel->compression) {
 	case CompressionNone:
-		memcpy(scratch.raw, kernel->data, sizeof(scratch.raw));
+		// The header can be read where the kernel already is.
+		if (kernel->size < sizeof(*header)) {
+			printf("ERROR: Kernel is too small for its header!\n");
+			return 1;
+		}
+		header = kernel->data;
 		break;
 	case CompressionLzma:
-		ulzman(kernel->data, kernel->size,
-		       scratch.raw, sizeof(scratch.raw));
-		break;
 	case CompressionLz4:
-		ulz4fn(kernel->data, kernel->size,
-		       scratch.raw, sizeof(scratch.raw));
+		// Partially decompress to get text_offset. Can't check for
+		// errors.
+		scratch.canary = SCRATCH_CANARY_VALUE;
+		decompress_kernel(kernel, scratch.raw, sizeof(scratch.raw));
+
+		// Should never happen, but if it does we'll want to know.
+		if (scratch.canary != SCRATCH_CANARY_VALUE) {
+			printf("ERROR: Partial decompression ran over scratchbuf!\n");
+			return 1;
+		}
 		break;
 	default:
 		printf("ERROR: Unsupported compression algorithm!\n");
 		return 1;
 	}
 
-	// Should never happen, but if it does we'll want to know.
-	if (scratch.canary != SCRATCH_CANARY_VALUE) {
-		printf("ERROR: Partial decompression ran over scratchbuf!\n");
-		return 1;
-	}
-
-	if (scratch.header.magic != KERNEL_HEADER_MAGIC) {
+	if (header->magic != KERNEL_HEADER_MAGIC) {
 		printf("ERROR: Invalid kernel magic: %#.8x\n != %#.8x\n",
-		       scratch.header.magic, KERNEL_HEADER_MAGIC);
+		       header->magic, KERNEL_HEADER_MAGIC);
 		return 1;
 	}
 
-	if (scratch.header.image_size)
-		image_size = scratch.header.image_size;
+	if (header->image_size)
+		image_size = header->image_size;
 	else
 		printf("WARNING: Kernel image_size is 0 (pre-3.17 kernel?)\n");
 
-	void *reloc_addr = get_kernel_reloc_addr(scratch.header.text_offset,
+	void *reloc_addr = get_kernel_reloc_addr(header->text_offset,
 						 image_size);
 	if (!reloc_addr)
 		return 1;
 
 	timestamp_add_now(TS_KERNEL_DECOMPRESSION);
 
-	size_t true_size = kernel->size;
-	switch (kernel->compression) {
-	case CompressionNone:
-		if (kernel->size > image_size) {
-			printf("ERROR: Kernel image_size was invalid!\n");
-			return 1;
-		}
+	if (kernel->compression == CompressionNone)
 		printf("Relocating kernel to %p\n", reloc_addr);
-		memmove(reloc_addr, kernel->data, kernel->size);
-		break;
-	case CompressionLzma:
-		printf("Decompressing LZMA kernel to %p\n", reloc_addr);
-		true_size = ulzman(kernel->data, kernel->size,
-				   reloc_addr, image_size);
-		if (!true_size) {
-			printf("ERROR: LZMA decompression failed!\n");
-			return 1;
-		}
-		break;
-	case CompressionLz4:
-		printf("Decompressing LZ4 kernel to %p\n", reloc_addr);
-		true_size = ulz4fn(kernel->data, kernel->size,
-				   reloc_addr, image_size);
-		if (!true_size) {
-			printf("ERROR: LZ4 decompression failed!\n");
-			return 1;
-		}
-		break;
-	default: // It's 2015 and GCC's reachability analyzer still sucks...
+	else
+		printf("Decompressing %s kernel to %p\n",
+		       compression_name(kernel), reloc_addr);
+	true_size = decompress_kernel(kernel, reloc_addr, image_size);
+	if (!true_size) {
+		if (kernel->compression == CompressionNone)
+			printf("ERROR: Kernel image_size was invalid!\n");
+		else
+			printf("ERROR: %s decompression failed!\n",
+			       compression_name(kernel));
 		return 1;
 	}
 
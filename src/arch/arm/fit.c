@@ -99,21 +99,22 @@ int boot(struct boot_info *bi)
 	if (dt_apply_fixups(tree))
 		return 1;
 
-	// Allocate a spot for the FDT in memory.
+	// Reserve the spot the device tree will go. The entry is part of
+	// the tree, so it has to be there before the tree is measured.
 	void *fdt = &_fit_fdt_start;
+	DeviceTreeReserveMapEntry *entry = xzalloc(sizeof(*entry));
+	entry->start = (uintptr_t)fdt;
+	list_insert_after(&entry->list_node, &tree->reserve_map);
+
 	uint32_t size = dt_flat_size(tree);
 	if (&_fit_fdt_start + size > &_fit_fdt_end) {
 		printf("ERROR: FDT image overflows buffer!\n");
 		return 1;
 	}
-
-	// Reserve the spot the device tree will go.
-	DeviceTreeReserveMapEntry *entry = xzalloc(sizeof(*entry));
-	entry->start = (uintptr_t)fdt;
 	entry->size = size;
-	list_insert_after(&entry->list_node, &tree->reserve_map);
 
-	// Flatten it.
+	// Flatten it. Parts of the tree fixups didn't touch are copied over
+	// from the original FDT as they are.
 	dt_flatten(tree, fdt);
 
 	run_cleanup_funcs(CleanupOnHandoff);
@@ -23,6 +23,38 @@
 #include <arch/cache.h>
 #include "base/physmem.h"
 
+/*
+ * Zero memory with DC ZVA, which zeroes a whole block in the cache without
+ * reading it from memory first. Use memset for the unaligned ends, or for
+ * everything if DC ZVA isn't allowed.
+ */
+static void arm64_zero(uint8_t *ptr, uint64_t size)
+{
+	uint64_t dczid, block;
+	uint8_t *end = ptr + size;
+	uint8_t *zva_start, *zva_end;
+
+	asm volatile("mrs %0, dczid_el0" : "=r"(dczid));
+	// DZP set means DC ZVA is prohibited.
+	if (dczid & (1 << 4)) {
+		memset(ptr, 0, size);
+		return;
+	}
+	block = 4 << (dczid & 0xf);
+
+	zva_start = (uint8_t *)ALIGN_UP((uintptr_t)ptr, block);
+	zva_end = (uint8_t *)ALIGN_DOWN((uintptr_t)end, block);
+	if (zva_start >= zva_end) {
+		memset(ptr, 0, size);
+		return;
+	}
+
+	memset(ptr, 0, zva_start - ptr);
+	for (uint8_t *p = zva_start; p < zva_end; p += block)
+		asm volatile("dc zva, %0" : : "r"(p) : "memory");
+	memset(zva_end, 0, end - zva_end);
+}
+
 uint64_t arch_phys_memset(uint64_t start, int c, uint64_t size)
 {
 	uint64_t max_addr = (uint64_t)((1ULL << 48) - 1);
@@ -32,7 +64,10 @@ uint64_t arch_phys_memset(uint64_t start, int c, uint64_t size)
 	if (end < start || end > max_addr)
 		size = max_addr - start;
 
-        memset((void *)(uintptr_t)start, c, size);
+	if (c == 0)
+		arm64_zero((uint8_t *)(uintptr_t)start, size);
+	else
+		memset((void *)(uintptr_t)start, c, size);
 
 	return start;
 }
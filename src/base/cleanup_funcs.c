@@ -19,6 +19,7 @@
 #include <libpayload.h>
 
 #include "base/cleanup_funcs.h"
+#include "base/profile.h"
 #include "debug/dev.h"
 
 ListNode cleanup_funcs;
@@ -30,12 +31,17 @@ int run_cleanup_funcs(CleanupType type)
 	CleanupFunc *func;
 	list_for_each(func, cleanup_funcs, list_node) {
 		assert(func->cleanup);
-		if ((func->types & type))
+		if ((func->types & type)) {
+			int span = profile_begin("cleanup", func->cleanup);
 			res = func->cleanup(func, type) || res;
+			profile_end(span);
+		}
 	}
 
 	dc_dev_gdb_exit(type);
 
+	profile_dump();
+
 	printf("Exiting depthcharge with code %d at timestamp: %llu\n",
 	       type, timer_us(0));
 
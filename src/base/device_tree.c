@@ -31,6 +31,18 @@ static uint32_t size32(uint32_t val)
 	return (val + sizeof(uint32_t) - 1) / sizeof(uint32_t);
 }
 
+static const uint32_t DtHashInit = 2166136261;
+
+// FNV-1a, which can be continued to hash a path one component at a time.
+static uint32_t dt_hash(uint32_t hash, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+
+	while (size--)
+		hash = (hash ^ *bytes++) * 16777619;
+	return hash;
+}
+
 int fdt_next_property(void *blob, uint32_t offset, FdtProperty *prop)
 {
 	FdtHeader *header = (FdtHeader *)blob;
@@ -157,27 +169,70 @@ int fdt_skip_node(void *blob, uint32_t start_offset)
  * Functions to turn a flattened tree into an unflattened one.
  */
 
-static DeviceTreeNode node_cache[1000];
-static int node_counter = 0;
-static DeviceTreeProperty prop_cache[5000];
-static int prop_counter = 0;
-
 /*
  * Libpayload's malloc() has linear allocation complexity and goes completely
- * mental after a few thousand small requests. This little hack will absorb
- * the worst of it to avoid increasing boot time for no reason.
+ * mental after a few thousand small requests. Nodes and properties are carved
+ * out of an arena instead, which is sized to fit the whole tree plus some room
+ * for fixups whenever a tree is unflattened.
  */
+static const int ArenaSpareNodes = 32;
+static const int ArenaSpareProps = 256;
+
+static DeviceTreeNode *node_arena;
+static int node_arena_left;
+static DeviceTreeProperty *prop_arena;
+static int prop_arena_left;
+
 static DeviceTreeNode *alloc_node(void)
 {
-	if (node_counter >= ARRAY_SIZE(node_cache))
+	if (!node_arena_left)
 		return xzalloc(sizeof(DeviceTreeNode));
-	return &node_cache[node_counter++];
+	node_arena_left--;
+	return node_arena++;
 }
 static DeviceTreeProperty *alloc_prop(void)
 {
-	if (prop_counter >= ARRAY_SIZE(prop_cache))
+	if (!prop_arena_left)
 		return xzalloc(sizeof(DeviceTreeProperty));
-	return &prop_cache[prop_counter++];
+	prop_arena_left--;
+	return prop_arena++;
+}
+
+static void fdt_count_entries(void *blob, uint32_t offset, int *nodes,
+			      int *props)
+{
+	for (;;) {
+		uint32_t token = betohl(*(uint32_t *)((uint8_t *)blob + offset));
+
+		if (token == TokenBeginNode) {
+			(*nodes)++;
+			offset += fdt_node_name(blob, offset, NULL);
+		} else if (token == TokenProperty) {
+			(*props)++;
+			offset += fdt_next_property(blob, offset, NULL);
+		} else if (token == TokenEndNode) {
+			offset += sizeof(uint32_t);
+		} else {
+			return;
+		}
+	}
+}
+
+static void fdt_alloc_arena(void *blob, uint32_t struct_offset)
+{
+	int nodes = ArenaSpareNodes;
+	int props = ArenaSpareProps;
+
+	fdt_count_entries(blob, struct_offset, &nodes, &props);
+
+	// Whatever is left of a previous arena is still in use by its tree.
+	uint8_t *arena = xzalloc(nodes * sizeof(DeviceTreeNode) +
+				 props * sizeof(DeviceTreeProperty));
+	node_arena = (DeviceTreeNode *)arena;
+	node_arena_left = nodes;
+	prop_arena = (DeviceTreeProperty *)(arena +
+					    nodes * sizeof(DeviceTreeNode));
+	prop_arena_left = props;
 }
 
 static int fdt_unflatten_node(void *blob, uint32_t start_offset,
@@ -212,6 +267,7 @@ static int fdt_unflatten_node(void *blob, uint32_t start_offset,
 	DeviceTreeNode *child;
 	last = &node->children;
 	while ((size = fdt_unflatten_node(blob, offset, &child))) {
+		child->parent = node;
 		list_insert_after(&child->list_node, last);
 		last = &child->list_node;
 
@@ -267,6 +323,7 @@ DeviceTree *fdt_unflatten(void *blob)
 		offset += size;
 	}
 
+	fdt_alloc_arena(blob, struct_offset);
 	fdt_unflatten_node(blob, struct_offset, &tree->root);
 
 	return tree;
@@ -275,138 +332,269 @@ DeviceTree *fdt_unflatten(void *blob)
 
 
 /*
- * Functions to find the size of device tree would take if it was flattened.
+ * Functions to flatten a device tree.
+ *
+ * Most of a tree usually comes through fixups untouched. Subtrees which still
+ * mirror the flat tree they were unflattened from are copied over from it
+ * wholesale, along with its whole string table, so only nodes which were
+ * actually changed have to be rebuilt. Property names which aren't in the
+ * original string table yet are added to it once each.
  */
 
-static void dt_flat_prop_size(DeviceTreeProperty *prop, uint32_t *struct_size,
-			      uint32_t *strings_size)
+typedef struct DtFlatString
 {
-	// Starting token.
-	*struct_size += sizeof(uint32_t);
-	// Size.
-	*struct_size += sizeof(uint32_t);
-	// Name offset.
-	*struct_size += sizeof(uint32_t);
-	// Property value.
-	*struct_size += size32(prop->prop.size) * sizeof(uint32_t);
-
-	// Property name.
-	*strings_size += strlen(prop->prop.name) + 1;
-}
-
-static void dt_flat_node_size(DeviceTreeNode *node, uint32_t *struct_size,
-			      uint32_t *strings_size)
+	const char *str;
+	uint32_t hash;
+	uint32_t offset;
+	// Index of the next string in the same bucket, or -1.
+	int next;
+} DtFlatString;
+
+typedef struct DtFlatContext
 {
-	// Starting token.
-	*struct_size += sizeof(uint32_t);
-	// Node name.
-	*struct_size += size32(strlen(node->name) + 1) * sizeof(uint32_t);
+	// The flat tree the unflattened one was read from, if it's usable.
+	uint8_t *blob;
+	uint32_t struct_start;
+	uint32_t struct_end;
+	const char *strings;
+	uint32_t strings_size;
+
+	// The string table of the tree being flattened.
+	DtFlatString *table;
+	int table_count;
+	int table_capacity;
+	int *buckets;
+	uint32_t mask;
+	uint32_t table_size;
+} DtFlatContext;
+
+static uint32_t dt_flat_string(DtFlatContext *ctx, const char *str,
+			       uint32_t offset)
+{
+	uint32_t hash = dt_hash(DtHashInit, str, strlen(str));
+	int *bucket = &ctx->buckets[hash & ctx->mask];
 
-	DeviceTreeProperty *prop;
-	list_for_each(prop, node->properties, list_node)
-		dt_flat_prop_size(prop, struct_size, strings_size);
+	for (int i = *bucket; i >= 0; i = ctx->table[i].next) {
+		if (ctx->table[i].hash == hash && !strcmp(ctx->table[i].str, str))
+			return ctx->table[i].offset;
+	}
 
-	DeviceTreeNode *child;
-	list_for_each(child, node->children, list_node)
-		dt_flat_node_size(child, struct_size, strings_size);
+	if (ctx->table_count == ctx->table_capacity) {
+		ctx->table_capacity *= 2;
+		ctx->table = realloc(ctx->table, ctx->table_capacity *
+					     sizeof(DtFlatString));
+		if (!ctx->table)
+			die("Out of memory flattening the device tree.\n");
+	}
 
-	// End token.
-	*struct_size += sizeof(uint32_t);
+	DtFlatString *entry = &ctx->table[ctx->table_count];
+	entry->str = str;
+	entry->hash = hash;
+	entry->offset = offset;
+	entry->next = *bucket;
+	*bucket = ctx->table_count++;
+
+	return offset;
 }
 
-uint32_t dt_flat_size(DeviceTree *tree)
+// Find where a property name goes in the string table, adding it if needed.
+static uint32_t dt_flat_name(DtFlatContext *ctx, const char *name)
 {
-	uint32_t size = tree->header_size;
-	DeviceTreeReserveMapEntry *entry;
-	list_for_each(entry, tree->reserve_map, list_node)
-		size += sizeof(uint64_t) * 2;
-	size += sizeof(uint64_t) * 2;
+	if (name >= ctx->strings && name < ctx->strings + ctx->strings_size)
+		return name - ctx->strings;
 
-	uint32_t struct_size = 0;
-	uint32_t strings_size = 0;
-	dt_flat_node_size(tree->root, &struct_size, &strings_size);
-
-	size += struct_size;
-	// End token.
-	size += sizeof(uint32_t);
+	uint32_t offset = dt_flat_string(ctx, name, ctx->table_size);
+	if (offset == ctx->table_size)
+		ctx->table_size += strlen(name) + 1;
+	return offset;
+}
 
-	size += strings_size;
+static void dt_flat_init(DtFlatContext *ctx, DeviceTree *tree)
+{
+	FdtHeader *header = tree->header;
+	int strings = 0;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	// Older versions don't say how big the structure block is.
+	if (betohl(header->magic) == FdtMagic &&
+	    betohl(header->version) >= 17) {
+		ctx->blob = tree->header;
+		ctx->struct_start = betohl(header->structure_offset);
+		ctx->struct_end = ctx->struct_start +
+				  betohl(header->structure_size);
+		ctx->strings = (char *)ctx->blob +
+			       betohl(header->strings_offset);
+		ctx->strings_size = betohl(header->strings_size);
+
+		for (uint32_t i = 0; i < ctx->strings_size; i++)
+			strings += !ctx->strings[i];
+	}
 
-	return size;
+	uint32_t buckets = 64;
+	while (buckets < strings * 2)
+		buckets <<= 1;
+	ctx->buckets = xmalloc(buckets * sizeof(int));
+	memset(ctx->buckets, 0xff, buckets * sizeof(int));
+	ctx->mask = buckets - 1;
+	ctx->table_capacity = MAX(strings, 16);
+	ctx->table = xmalloc(ctx->table_capacity * sizeof(DtFlatString));
+
+	// Names of unchanged properties keep pointing into the original
+	// string table, so it's kept as is. New names can share its entries.
+	for (uint32_t offset = 0; offset < ctx->strings_size;) {
+		const char *str = &ctx->strings[offset];
+		dt_flat_string(ctx, str, offset);
+		offset += strnlen(str, ctx->strings_size - offset) + 1;
+	}
+	ctx->table_size = ctx->strings_size;
 }
 
-
+static void dt_flat_free(DtFlatContext *ctx)
+{
+	free(ctx->table);
+	free(ctx->buckets);
+}
 
 /*
- * Functions to flatten a device tree.
+ * If a node and everything below it still mirror the flat tree they were
+ * unflattened from, return how many bytes they take up in its structure
+ * block. Otherwise return 0.
  */
-
-static void dt_flatten_map_entry(DeviceTreeReserveMapEntry *entry,
-				 void **map_start)
+static uint32_t dt_pristine_size(DtFlatContext *ctx, DeviceTreeNode *node)
 {
-	((uint64_t *)*map_start)[0] = htobell(entry->start);
-	((uint64_t *)*map_start)[1] = htobell(entry->size);
-	*map_start = ((uint8_t *)*map_start) + sizeof(uint64_t) * 2;
-}
+	uint8_t *name = (uint8_t *)node->name;
+	uint8_t *blob = ctx->blob;
+	int size;
 
-static void dt_flatten_prop(DeviceTreeProperty *prop, void **struct_start,
-			    void *strings_base, void **strings_start)
-{
-	uint8_t *dstruct = (uint8_t *)*struct_start;
-	uint8_t *dstrings = (uint8_t *)*strings_start;
+	if (!blob || name < blob + ctx->struct_start + sizeof(uint32_t) ||
+	    name >= blob + ctx->struct_end ||
+	    (name - blob) % sizeof(uint32_t))
+		return 0;
 
-	*((uint32_t *)dstruct) = htobel(TokenProperty);
-	dstruct += sizeof(uint32_t);
+	uint32_t start = name - blob - sizeof(uint32_t);
+	uint32_t offset = start;
 
-	*((uint32_t *)dstruct) = htobel(prop->prop.size);
-	dstruct += sizeof(uint32_t);
+	size = fdt_node_name(blob, offset, NULL);
+	if (!size)
+		return 0;
+	offset += size;
 
-	uint32_t name_offset = (uintptr_t)dstrings - (uintptr_t)strings_base;
-	*((uint32_t *)dstruct) = htobel(name_offset);
-	dstruct += sizeof(uint32_t);
+	DeviceTreeProperty *prop;
+	list_for_each(prop, node->properties, list_node) {
+		FdtProperty fprop;
 
-	strcpy((char *)dstrings, prop->prop.name);
-	dstrings += strlen(prop->prop.name) + 1;
+		size = fdt_next_property(blob, offset, &fprop);
+		if (!size || fprop.name != prop->prop.name ||
+		    fprop.data != prop->prop.data ||
+		    fprop.size != prop->prop.size)
+			return 0;
+		offset += size;
+	}
+	// Check whether a property was removed.
+	if (fdt_next_property(blob, offset, NULL))
+		return 0;
 
-	memcpy(dstruct, prop->prop.data, prop->prop.size);
-	dstruct += size32(prop->prop.size) * 4;
+	DeviceTreeNode *child;
+	list_for_each(child, node->children, list_node) {
+		if ((uint8_t *)child->name != blob + offset + sizeof(uint32_t))
+			return 0;
+		size = dt_pristine_size(ctx, child);
+		if (!size)
+			return 0;
+		offset += size;
+	}
+	// Check whether a child was removed.
+	if (betohl(*(uint32_t *)(blob + offset)) != TokenEndNode)
+		return 0;
 
-	*struct_start = dstruct;
-	*strings_start = dstrings;
+	return offset + sizeof(uint32_t) - start;
 }
 
-static void dt_flatten_node(DeviceTreeNode *node, void **struct_start,
-			    void *strings_base, void **strings_start)
+/*
+ * Lay out a node in the structure block and return its size. The node is
+ * only written out if dest isn't NULL.
+ */
+static uint32_t dt_flatten_node(DtFlatContext *ctx, DeviceTreeNode *node,
+				uint8_t *dest)
 {
-	uint8_t *dstruct = (uint8_t *)*struct_start;
-	uint8_t *dstrings = (uint8_t *)*strings_start;
+	uint32_t size = dt_pristine_size(ctx, node);
 
-	*((uint32_t *)dstruct) = htobel(TokenBeginNode);
-	dstruct += sizeof(uint32_t);
+	if (size) {
+		if (dest)
+			memcpy(dest, node->name - sizeof(uint32_t), size);
+		return size;
+	}
 
-	strcpy((char *)dstruct, node->name);
-	dstruct += size32(strlen(node->name) + 1) * 4;
+	uint32_t name_size = size32(strlen(node->name) + 1) * sizeof(uint32_t);
+	if (dest) {
+		*(uint32_t *)dest = htobel(TokenBeginNode);
+		memset(dest + sizeof(uint32_t), 0, name_size);
+		strcpy((char *)dest + sizeof(uint32_t), node->name);
+	}
+	size = sizeof(uint32_t) + name_size;
 
 	DeviceTreeProperty *prop;
-	list_for_each(prop, node->properties, list_node)
-		dt_flatten_prop(prop, (void **)&dstruct, strings_base,
-				(void **)&dstrings);
+	list_for_each(prop, node->properties, list_node) {
+		uint32_t name_offset = dt_flat_name(ctx, prop->prop.name);
+		uint32_t data_size = size32(prop->prop.size) *
+				     sizeof(uint32_t);
+
+		if (dest) {
+			uint32_t *ptr = (uint32_t *)(dest + size);
+			ptr[0] = htobel(TokenProperty);
+			ptr[1] = htobel(prop->prop.size);
+			ptr[2] = htobel(name_offset);
+			memset(&ptr[3], 0, data_size);
+			memcpy(&ptr[3], prop->prop.data, prop->prop.size);
+		}
+		size += sizeof(uint32_t) * 3 + data_size;
+	}
 
 	DeviceTreeNode *child;
 	list_for_each(child, node->children, list_node)
-		dt_flatten_node(child, (void **)&dstruct, strings_base,
-				(void **)&dstrings);
+		size += dt_flatten_node(ctx, child, dest ? dest + size : NULL);
 
-	*((uint32_t *)dstruct) = htobel(TokenEndNode);
-	dstruct += sizeof(uint32_t);
+	if (dest)
+		*(uint32_t *)(dest + size) = htobel(TokenEndNode);
+	size += sizeof(uint32_t);
 
-	*struct_start = dstruct;
-	*strings_start = dstrings;
+	return size;
+}
+
+uint32_t dt_flat_size(DeviceTree *tree)
+{
+	DtFlatContext ctx;
+	uint32_t size = tree->header_size;
+	DeviceTreeReserveMapEntry *entry;
+	list_for_each(entry, tree->reserve_map, list_node)
+		size += sizeof(uint64_t) * 2;
+	size += sizeof(uint64_t) * 2;
+
+	dt_flat_init(&ctx, tree);
+	size += dt_flatten_node(&ctx, tree->root, NULL);
+	// End token.
+	size += sizeof(uint32_t);
+	size += ctx.table_size;
+	dt_flat_free(&ctx);
+
+	return size;
+}
+
+static void dt_flatten_map_entry(DeviceTreeReserveMapEntry *entry,
+				 void **map_start)
+{
+	((uint64_t *)*map_start)[0] = htobell(entry->start);
+	((uint64_t *)*map_start)[1] = htobell(entry->size);
+	*map_start = ((uint8_t *)*map_start) + sizeof(uint64_t) * 2;
 }
 
 void dt_flatten(DeviceTree *tree, void *start_dest)
 {
 	uint8_t *dest = (uint8_t *)start_dest;
+	DtFlatContext ctx;
+
+	dt_flat_init(&ctx, tree);
 
 	memcpy(dest, tree->header, tree->header_size);
 	FdtHeader *header = (FdtHeader *)dest;
@@ -418,11 +606,7 @@ void dt_flatten(DeviceTree *tree, void *start_dest)
 	((uint64_t *)dest)[0] = ((uint64_t *)dest)[1] = 0;
 	dest += sizeof(uint64_t) * 2;
 
-	uint32_t struct_size = 0;
-	uint32_t strings_size = 0;
-	dt_flat_node_size(tree->root, &struct_size, &strings_size);
-
-	uint8_t *struct_start = dest;
+	uint32_t struct_size = dt_flatten_node(&ctx, tree->root, dest);
 	header->structure_offset = htobel(dest - (uint8_t *)start_dest);
 	header->structure_size = htobel(struct_size);
 	dest += struct_size;
@@ -430,15 +614,20 @@ void dt_flatten(DeviceTree *tree, void *start_dest)
 	*((uint32_t *)dest) = htobel(TokenEnd);
 	dest += sizeof(uint32_t);
 
-	uint8_t *strings_start = dest;
 	header->strings_offset = htobel(dest - (uint8_t *)start_dest);
-	header->strings_size = htobel(strings_size);
-	dest += strings_size;
-
-	dt_flatten_node(tree->root, (void **)&struct_start, strings_start,
-			(void **)&strings_start);
+	header->strings_size = htobel(ctx.table_size);
+	if (ctx.strings_size)
+		memcpy(dest, ctx.strings, ctx.strings_size);
+	for (int i = 0; i < ctx.table_count; i++) {
+		DtFlatString *str = &ctx.table[i];
+		if (str->offset >= ctx.strings_size)
+			strcpy((char *)dest + str->offset, str->str);
+	}
+	dest += ctx.table_size;
 
 	header->totalsize = htobel(dest - (uint8_t *)start_dest);
+
+	dt_flat_free(&ctx);
 }
 
 
@@ -468,6 +657,230 @@ void dt_print_node(DeviceTreeNode *node)
 
 
 
+/*
+ * Hash indexes over an unflattened device tree.
+ *
+ * Paths, compatible strings and phandles are indexed the first time they are
+ * looked up, and the indexes are thrown away whenever the tree changes in a
+ * way which affects them. Entries of each hash chain are kept in depth first
+ * order so lookups return the same nodes a walk of the tree would.
+ */
+
+enum {
+	DtIndexPath,
+	DtIndexCompat,
+	DtIndexPhandle,
+	DtIndexKinds
+};
+
+typedef struct DtIndexEntry
+{
+	struct DtIndexEntry *next;
+	uint32_t hash;
+	DeviceTreeNode *node;
+	// The compatible string or the name of the phandle property.
+	const char *key;
+	size_t key_size;
+} DtIndexEntry;
+
+typedef struct DtIndexTable
+{
+	DtIndexEntry *entries;
+	uint32_t count;
+	DtIndexEntry **buckets;
+	uint32_t mask;
+} DtIndexTable;
+
+static struct {
+	DeviceTreeNode *root;
+	uint32_t generation;
+	DtIndexTable tables[DtIndexKinds];
+} dt_index;
+
+// Bumped whenever a tree changes, which makes the indexes stale.
+static uint32_t dt_generation = 1;
+
+void dt_invalidate_indexes(void)
+{
+	dt_generation++;
+}
+
+static void dt_index_add(int kind, uint32_t hash, DeviceTreeNode *node,
+			 const char *key, size_t key_size)
+{
+	DtIndexTable *table = &dt_index.tables[kind];
+
+	// The first pass over the tree only counts entries.
+	if (table->entries) {
+		DtIndexEntry *entry = &table->entries[table->count];
+		entry->hash = hash;
+		entry->node = node;
+		entry->key = key;
+		entry->key_size = key_size;
+	}
+	table->count++;
+}
+
+static void dt_index_node(DeviceTreeNode *node, DeviceTreeNode *parent,
+			  uint32_t path_hash)
+{
+	DeviceTreeProperty *prop;
+	int found_compat = 0;
+
+	node->parent = parent;
+	dt_index_add(DtIndexPath, path_hash, node, NULL, 0);
+
+	list_for_each(prop, node->properties, list_node) {
+		const char *name = prop->prop.name;
+
+		// Only the first compatible property counts, like in
+		// dt_check_compat_match().
+		if (!found_compat && !strcmp(name, "compatible")) {
+			size_t bytes = prop->prop.size;
+			const char *str = prop->prop.data;
+
+			found_compat = 1;
+			while (bytes > 0) {
+				size_t len = strnlen(str, bytes);
+				dt_index_add(DtIndexCompat,
+					     dt_hash(DtHashInit, str, len),
+					     node, str, bytes);
+				if (bytes <= len + 1)
+					break;
+				str += len + 1;
+				bytes -= len + 1;
+			}
+		} else if ((!strcmp(name, "phandle") ||
+			    !strcmp(name, "linux,phandle")) &&
+			   prop->prop.size == sizeof(uint32_t)) {
+			// Phandles are small and sequential, so they make
+			// perfectly good hashes on their own.
+			dt_index_add(DtIndexPhandle,
+				     betohl(*(uint32_t *)prop->prop.data),
+				     node, name, prop->prop.size);
+		}
+	}
+
+	DeviceTreeNode *child;
+	list_for_each(child, node->children, list_node) {
+		uint32_t hash = dt_hash(path_hash, "/", 1);
+		hash = dt_hash(hash, child->name, strlen(child->name));
+		dt_index_node(child, node, hash);
+	}
+}
+
+static void dt_index_build(DeviceTreeNode *root)
+{
+	int kind;
+
+	for (kind = 0; kind < DtIndexKinds; kind++) {
+		DtIndexTable *table = &dt_index.tables[kind];
+		free(table->entries);
+		free(table->buckets);
+		memset(table, 0, sizeof(*table));
+	}
+
+	dt_index_node(root, NULL, DtHashInit);
+
+	for (kind = 0; kind < DtIndexKinds; kind++) {
+		DtIndexTable *table = &dt_index.tables[kind];
+		uint32_t buckets = 16;
+
+		while (buckets < table->count * 2)
+			buckets <<= 1;
+		table->entries = xmalloc(MAX(table->count, 1) *
+					 sizeof(DtIndexEntry));
+		table->buckets = xzalloc(buckets * sizeof(DtIndexEntry *));
+		table->mask = buckets - 1;
+		table->count = 0;
+	}
+
+	dt_index_node(root, NULL, DtHashInit);
+
+	// Push entries in reverse so each chain ends up in tree order.
+	for (kind = 0; kind < DtIndexKinds; kind++) {
+		DtIndexTable *table = &dt_index.tables[kind];
+
+		for (int i = table->count - 1; i >= 0; i--) {
+			DtIndexEntry *entry = &table->entries[i];
+			DtIndexEntry **bucket =
+				&table->buckets[entry->hash & table->mask];
+			entry->next = *bucket;
+			*bucket = entry;
+		}
+	}
+
+	dt_index.root = root;
+	dt_index.generation = dt_generation;
+}
+
+// Return the first entry of the chain a hash would be in, indexing the tree
+// which contains node first if necessary.
+static DtIndexEntry *dt_index_lookup(DeviceTreeNode *node, int kind,
+				     uint32_t hash)
+{
+	DeviceTreeNode *root = node;
+
+	while (root->parent)
+		root = root->parent;
+
+	if (dt_index.root != root || dt_index.generation != dt_generation)
+		dt_index_build(root);
+
+	DtIndexTable *table = &dt_index.tables[kind];
+	return table->buckets[hash & table->mask];
+}
+
+static int dt_is_descendant(DeviceTreeNode *node, DeviceTreeNode *ancestor)
+{
+	for (; node; node = node->parent) {
+		if (node == ancestor)
+			return 1;
+	}
+	return 0;
+}
+
+// Check whether the names of a node and its ancestors spell out path.
+static int dt_path_matches(DeviceTreeNode *node, const char *path, size_t len)
+{
+	for (; node->parent; node = node->parent) {
+		size_t name_len = strlen(node->name);
+
+		if (len < name_len + 1 || path[len - name_len - 1] != '/' ||
+		    memcmp(&path[len - name_len], node->name, name_len))
+			return 0;
+		len -= name_len + 1;
+	}
+	return !len;
+}
+
+static DeviceTreeNode *dt_index_find_path(DeviceTreeNode *root,
+					  const char *path)
+{
+	size_t len = strlen(path);
+	uint32_t hash = dt_hash(DtHashInit, path, len);
+	DtIndexEntry *entry;
+
+	for (entry = dt_index_lookup(root, DtIndexPath, hash); entry;
+	     entry = entry->next) {
+		if (entry->hash == hash && dt_path_matches(entry->node, path,
+							   len))
+			return entry->node;
+	}
+	return NULL;
+}
+
+// Pick up #address-cells and #size-cells from the root down to a node.
+static void dt_read_cell_props_up(DeviceTreeNode *node, u32 *addrcp,
+				  u32 *sizecp)
+{
+	if (node->parent)
+		dt_read_cell_props_up(node->parent, addrcp, sizecp);
+	dt_read_cell_props(node, addrcp, sizecp);
+}
+
+
+
 /*
  * Functions for reading and manipulating an unflattened device tree.
  */
@@ -528,17 +941,46 @@ DeviceTreeNode *dt_find_node(DeviceTreeNode *parent, const char **path,
 		if (!create)
 			return NULL;
 
-		found = alloc_node();
-		found->name = strdup(*path);
-		if (!found->name)
+		char *name = strdup(*path);
+		if (!name)
 			return NULL;
 
-		list_insert_after(&found->list_node, &parent->children);
+		found = dt_add_child(parent, name);
 	}
 
 	return dt_find_node(found, path + 1, addrcp, sizecp, create);
 }
 
+/*
+ * Create an empty node and link it into a tree.
+ *
+ * @param parent	The node the new node becomes a child of.
+ * @param name		The name of the new node. It isn't copied.
+ * @return		The new node.
+ */
+DeviceTreeNode *dt_add_child(DeviceTreeNode *parent, const char *name)
+{
+	DeviceTreeNode *node = alloc_node();
+
+	node->name = name;
+	node->parent = parent;
+	list_insert_after(&node->list_node, &parent->children);
+	dt_invalidate_indexes();
+	return node;
+}
+
+/*
+ * Unlink a node, along with everything below it, from its tree.
+ *
+ * @param node		The node to remove.
+ */
+void dt_delete_node(DeviceTreeNode *node)
+{
+	list_remove(&node->list_node);
+	node->parent = NULL;
+	dt_invalidate_indexes();
+}
+
 /*
  * Find a node from a device tree path string.
  *
@@ -570,6 +1012,14 @@ DeviceTreeNode *dt_find_node_by_path(DeviceTree *tree, const char *path,
 	DeviceTreeNode *node = NULL;
 
 	if (path[0] == '/') { // regular path
+		node = dt_index_find_path(tree->root, path);
+		if (node) {
+			dt_read_cell_props_up(node, addrcp, sizecp);
+			return node;
+		}
+		if (!create)
+			return NULL;
+
 		sub_path = duped_str = strdup(&path[1]);
 		if (!sub_path)
 			return NULL;
@@ -687,15 +1137,15 @@ static int dt_check_compat_match(DeviceTreeNode *node, const char *compat)
  */
 DeviceTreeNode *dt_find_compat(DeviceTreeNode *parent, const char *compat)
 {
-	// Check if the parent node itself is compatible.
-	if (dt_check_compat_match(parent, compat))
-		return parent;
-
-	DeviceTreeNode *child;
-	list_for_each(child, parent->children, list_node) {
-		DeviceTreeNode *found = dt_find_compat(child, compat);
-		if (found)
-			return found;
+	uint32_t hash = dt_hash(DtHashInit, compat, strlen(compat));
+	DtIndexEntry *entry;
+
+	for (entry = dt_index_lookup(parent, DtIndexCompat, hash); entry;
+	     entry = entry->next) {
+		if (entry->hash == hash &&
+		    !strncmp(compat, entry->key, entry->key_size) &&
+		    dt_is_descendant(entry->node, parent))
+			return entry->node;
 	}
 
 	return NULL;
@@ -749,6 +1199,20 @@ DeviceTreeNode *dt_find_prop_value(DeviceTreeNode *parent, const char *name,
 {
 	DeviceTreeProperty *prop;
 
+	if ((!strcmp(name, "phandle") || !strcmp(name, "linux,phandle")) &&
+	    size == sizeof(uint32_t)) {
+		uint32_t hash = betohl(*(uint32_t *)data);
+		DtIndexEntry *entry;
+
+		for (entry = dt_index_lookup(parent, DtIndexPhandle, hash);
+		     entry; entry = entry->next) {
+			if (entry->hash == hash && !strcmp(name, entry->key) &&
+			    dt_is_descendant(entry->node, parent))
+				return entry->node;
+		}
+		return NULL;
+	}
+
 	/* Check if parent itself has the required property value. */
 	list_for_each(prop, parent->properties, list_node) {
 		if (!strcmp(name, prop->prop.name)) {
@@ -772,6 +1236,26 @@ DeviceTreeNode *dt_find_prop_value(DeviceTreeNode *parent, const char *name,
 	return NULL;
 }
 
+/*
+ * Find a node from its phandle.
+ *
+ * @param tree		The device tree.
+ * @param phandle	The phandle to look for.
+ * @return		The found node, or NULL.
+ */
+DeviceTreeNode *dt_find_node_by_phandle(DeviceTree *tree, uint32_t phandle)
+{
+	uint32_t value = htobel(phandle);
+	DeviceTreeNode *node;
+
+	node = dt_find_prop_value(tree->root, "phandle", &value,
+				  sizeof(value));
+	if (!node)
+		node = dt_find_prop_value(tree->root, "linux,phandle", &value,
+					  sizeof(value));
+	return node;
+}
+
 /*
  * Write an arbitrary sized big-endian integer into a pointer.
  *
@@ -800,6 +1284,11 @@ void dt_add_bin_prop(DeviceTreeNode *node, const char *name, void *data,
 {
 	DeviceTreeProperty *prop;
 
+	// Compatible strings and phandles are indexed.
+	if (!strcmp(name, "compatible") || !strcmp(name, "phandle") ||
+	    !strcmp(name, "linux,phandle"))
+		dt_invalidate_indexes();
+
 	list_for_each(prop, node->properties, list_node) {
 		if (!strcmp(prop->prop.name, name)) {
 			prop->prop.data = data;
@@ -76,6 +76,8 @@ typedef struct DeviceTreeNode
 	ListNode properties;
 	// List of DeviceTreeNodes.
 	ListNode children;
+	// Kept up to date by the dt_* functions, see dt_invalidate_indexes().
+	struct DeviceTreeNode *parent;
 
 	ListNode list_node;
 } DeviceTreeNode;
@@ -126,7 +128,9 @@ DeviceTree *fdt_unflatten(void *blob);
 
 // Figure out how big a device tree would be if it were flattened.
 uint32_t dt_flat_size(DeviceTree *tree);
-// Flatten a device tree into the buffer pointed to by dest.
+// Flatten a device tree into the buffer pointed to by dest. Subtrees which
+// haven't changed since fdt_unflatten() are copied from the original flat
+// tree, so it has to still be around and must not overlap dest.
 void dt_flatten(DeviceTree *tree, void *dest);
 void dt_print_node(DeviceTreeNode *node);
 // Read #address-cells and #size-cells properties from a node.
@@ -151,6 +155,15 @@ DeviceTreeNode *dt_find_next_compat_child(DeviceTreeNode *parent,
 // Look up a node relative to a parent node, through its property value.
 DeviceTreeNode *dt_find_prop_value(DeviceTreeNode *parent, const char *name,
 				   void *data, size_t size);
+// Look up a node through its phandle.
+DeviceTreeNode *dt_find_node_by_phandle(DeviceTree *tree, uint32_t phandle);
+// Add an empty child node, or unlink a node and its children from the tree.
+DeviceTreeNode *dt_add_child(DeviceTreeNode *parent, const char *name);
+void dt_delete_node(DeviceTreeNode *node);
+// Path, compatible and phandle lookups go through hash indexes which are
+// built on first use. The dt_* functions keep them up to date, but code which
+// links nodes into or out of a tree by hand has to drop them afterwards.
+void dt_invalidate_indexes(void);
 // Write src into *dest as a 'length'-byte big-endian integer.
 void dt_write_int(u8 *dest, u64 src, size_t length);
 // Add different kinds of properties to a node, or update existing ones.
@@ -15,17 +15,94 @@
  * GNU General Public License for more details.
  */
 
+#include <libpayload.h>
+
 #include "base/init_funcs.h"
+#include "base/profile.h"
 #include "image/symbols.h"
 
+typedef enum {
+	InitFuncPending,
+	InitFuncDone,
+} InitFuncState;
+
+static int init_func_ready(InitFunc *start, InitFunc *end, InitFunc *init,
+			   uint8_t *state)
+{
+	for (const char *const *dep = init->deps; *dep; dep++) {
+		for (InitFunc *other = start; other != end; other++) {
+			if (!strcmp(other->name, *dep) &&
+			    state[other - start] != InitFuncDone)
+				return 0;
+		}
+	}
+	return 1;
+}
+
 int run_init_funcs(void)
 {
-	init_func_t *start = (init_func_t *)&_init_funcs_start;
-	init_func_t *end = (init_func_t *)&_init_funcs_end;
+	InitFunc *start = (InitFunc *)&_init_funcs_start;
+	InitFunc *end = (InitFunc *)&_init_funcs_end;
+	int count = end - start;
+	int left = count, regular_left = 0;
 	int res = 0;
 
-	for (init_func_t *init_func = start; init_func != end; init_func++)
-		res = (*init_func)() || res;
+	if (!count)
+		return 0;
+
+	uint8_t *state = xzalloc(count);
+
+	for (InitFunc *init = start; init != end; init++)
+		if (!(init->flags & InitFuncDeferred))
+			regular_left++;
+
+	/*
+	 * Keep making passes over the init funcs, running each one whose
+	 * dependencies are done. Polled init funcs get called again on every
+	 * pass until they're done too, so several of them can wait for their
+	 * hardware at the same time.
+	 */
+	while (left) {
+		int ran = 0;
+
+		for (int i = 0; i < count; i++) {
+			InitFunc *init = &start[i];
+
+			if (state[i] == InitFuncDone)
+				continue;
+			if ((init->flags & InitFuncDeferred) && regular_left)
+				continue;
+			if (!init_func_ready(start, end, init, state))
+				continue;
+
+			// Polled init funcs get a span per call, so that spans
+			// opened by other init funcs in between nest properly.
+			int span = profile_begin(init->name, NULL);
+			int ret = init->func();
+			profile_end(span);
+			ran = 1;
+			if ((init->flags & InitFuncPolled) &&
+			    ret == InitFuncAgain)
+				continue;
+
+			state[i] = InitFuncDone;
+			left--;
+			if (!(init->flags & InitFuncDeferred))
+				regular_left--;
+			res = ret || res;
+		}
+
+		if (!ran) {
+			printf("Init funcs waiting on each other:");
+			for (int i = 0; i < count; i++)
+				if (state[i] != InitFuncDone)
+					printf(" %s", start[i].name);
+			printf("\n");
+			res = 1;
+			break;
+		}
+	}
 
+	free(state);
 	return res;
 }
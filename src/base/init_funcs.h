@@ -20,9 +20,44 @@
 
 typedef int (*init_func_t)(void);
 
-#define INIT_FUNC(func) \
-	init_func_t __init_func_ptr__##func \
-		__attribute__((section(".init_funcs"))) = &func;
+enum {
+	// Returned by polled init funcs which aren't done yet.
+	InitFuncAgain = 0x7fff,
+};
+
+enum {
+	// Called over and over until it stops returning InitFuncAgain, taking
+	// turns with the other init funcs which are ready to run until then.
+	// Use this instead of busy waiting for hardware to come up.
+	InitFuncPolled = 1 << 0,
+	// Only started once all the other init funcs are done.
+	InitFuncDeferred = 1 << 1,
+};
+
+typedef struct InitFunc
+{
+	init_func_t func;
+	const char *name;
+	// NULL terminated names of init funcs which have to finish first.
+	// Names of init funcs which aren't built in are ignored.
+	const char *const *deps;
+	unsigned flags;
+} InitFunc;
+
+#define _INIT_FUNC(func, flags, ...) \
+	static const char *const __init_func_deps__##func[] = { __VA_ARGS__ }; \
+	InitFunc __init_func_ptr__##func \
+		__attribute__((section(".init_funcs"))) = \
+		{ &func, #func, __init_func_deps__##func, flags };
+
+// Init funcs without dependencies run in link order. The variants below take
+// the names of the init funcs they depend on as further arguments.
+#define INIT_FUNC(func) _INIT_FUNC(func, 0, NULL)
+#define INIT_FUNC_AFTER(func, ...) _INIT_FUNC(func, 0, __VA_ARGS__, NULL)
+#define INIT_FUNC_POLLED(func, ...) \
+	_INIT_FUNC(func, InitFuncPolled, ##__VA_ARGS__, NULL)
+#define INIT_FUNC_DEFERRED(func, ...) \
+	_INIT_FUNC(func, InitFuncDeferred, ##__VA_ARGS__, NULL)
 
 int run_init_funcs(void);
 
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2018 Google Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <config.h>
+#include <libpayload.h>
+#include <stdint.h>
+
+#include "base/profile.h"
+
+typedef struct ProfileSpan {
+	const char *name;
+	const void *addr;
+	// Raw timer values. end is zero while the span is still open.
+	uint64_t start;
+	uint64_t end;
+	uint64_t bytes;
+	int depth;
+} ProfileSpan;
+
+static ProfileSpan profile_spans[CONFIG_PROFILE_ENTRIES];
+// Spans started so far. Span n lives in slot n % CONFIG_PROFILE_ENTRIES
+// until it's overwritten.
+static int profile_count;
+// Spans dropped by profile_reset().
+static int profile_first;
+static int profile_depth;
+
+int profile_begin(const char *name, const void *addr)
+{
+	if (!CONFIG_PROFILE)
+		return -1;
+
+	ProfileSpan *span =
+		&profile_spans[profile_count % CONFIG_PROFILE_ENTRIES];
+	span->name = name;
+	span->addr = addr;
+	span->end = 0;
+	span->bytes = 0;
+	span->depth = profile_depth++;
+	span->start = timer_raw_value();
+
+	return profile_count++;
+}
+
+void profile_end_bytes(int id, uint64_t bytes)
+{
+	if (!CONFIG_PROFILE || id < 0)
+		return;
+
+	uint64_t now = timer_raw_value();
+
+	if (profile_depth)
+		profile_depth--;
+
+	// The slot may have been reused by a newer span in the meantime.
+	if (id + CONFIG_PROFILE_ENTRIES <= profile_count)
+		return;
+
+	ProfileSpan *span = &profile_spans[id % CONFIG_PROFILE_ENTRIES];
+	span->end = now;
+	span->bytes = bytes;
+}
+
+void profile_end(int id)
+{
+	profile_end_bytes(id, 0);
+}
+
+void profile_dump(void)
+{
+	if (!CONFIG_PROFILE)
+		return;
+
+	uint64_t hz = timer_hz();
+	int first = MAX(profile_first,
+			profile_count - CONFIG_PROFILE_ENTRIES);
+
+	printf("Profile (%d spans, %d lost):\n", profile_count - first,
+	       first - profile_first);
+	printf("  start us      time us  span\n");
+
+	for (int i = first; i < profile_count; i++) {
+		ProfileSpan *span = &profile_spans[i % CONFIG_PROFILE_ENTRIES];
+		uint64_t start_us = span->start * 1000000 / hz;
+
+		printf("%9llu ", start_us);
+		if (span->end) {
+			uint64_t us = (span->end - span->start) * 1000000 / hz;
+			printf("%12llu  ", us);
+		} else {
+			printf("%12s  ", "open");
+		}
+
+		printf("%*s%s", span->depth * 2, "", span->name);
+		if (span->addr)
+			printf(" %p", span->addr);
+		if (span->bytes && span->end > span->start) {
+			uint64_t us = (span->end - span->start) * 1000000 / hz;
+			printf(" (%llu KiB, %llu MB/s)", span->bytes / KiB,
+			       profile_mbps(span->bytes, us));
+		}
+		printf("\n");
+	}
+}
+
+void profile_reset(void)
+{
+	// Open spans are left alone so their ends still match up.
+	profile_first = profile_count;
+}
+
+uint64_t profile_mbps(uint64_t bytes, uint64_t us)
+{
+	// Bytes per microsecond is (decimal) MB/s.
+	return bytes / MAX(us, 1);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2018 Google Inc.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BASE_PROFILE_H__
+#define __BASE_PROFILE_H__
+
+#include <stdint.h>
+
+/*
+ * Spans of time spent in parts of depthcharge, kept in a ring buffer of their
+ * own rather than in coreboot's timestamp table. Spans nest, and spans for
+ * I/O can record how many bytes they moved. All of this compiles down to
+ * nothing unless CONFIG_PROFILE is set.
+ */
+
+// Start a span and return a handle for it. The name has to stay around, so
+// it's usually a string literal. addr optionally points at the function the
+// span should be attributed to.
+int profile_begin(const char *name, const void *addr);
+// End a span, recording how many bytes it moved.
+void profile_end_bytes(int span, uint64_t bytes);
+// End a span.
+void profile_end(int span);
+
+// Print the spans which are still in the ring buffer.
+void profile_dump(void);
+// Throw away all finished spans.
+void profile_reset(void);
+
+// Throughput of moving bytes in us microseconds, in (decimal) MB/s. This
+// works whether or not CONFIG_PROFILE is set.
+uint64_t profile_mbps(uint64_t bytes, uint64_t us);
+
+#endif /* __BASE_PROFILE_H__ */
@@ -118,6 +118,22 @@ void ranges_sub(Ranges *ranges, uint64_t start, uint64_t end)
 	ranges_set_region_to(ranges, start, end, 0);
 }
 
+/* Check whether a region lies entirely within one range. */
+int ranges_contains(Ranges *ranges, uint64_t start, uint64_t end)
+{
+	int included = 0;
+	RangesEdge *cur = ranges->head.next;
+
+	/* Find the region start falls into. */
+	while (cur && cur->pos <= start) {
+		cur = cur->next;
+		included = !included;
+	}
+
+	/* The next edge, if any, ends the range containing start. */
+	return included && (!cur || cur->pos >= end);
+}
+
 /* Run a function on each range in Ranges. */
 void ranges_for_each(Ranges *ranges, RangesForEachFunc func, void *data)
 {
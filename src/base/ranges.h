@@ -67,6 +67,17 @@ void ranges_add(Ranges *ranges, uint64_t start, uint64_t end);
  */
 void ranges_sub(Ranges *ranges, uint64_t start, uint64_t end);
 
+/*
+ * Checks whether a region is entirely covered by the ranges.
+ *
+ * @param ranges	Ranges structure to check against.
+ * @param start		The start of the region.
+ * @param end		The end of the region.
+ *
+ * @return 1 if every position in the region is included, 0 otherwise.
+ */
+int ranges_contains(Ranges *ranges, uint64_t start, uint64_t end);
+
 typedef void (*RangesForEachFunc)(uint64_t start, uint64_t end, void *data);
 
 /*
@@ -41,9 +41,17 @@ void timestamp_add(enum timestamp_id id, uint64_t ts_time)
 {
 	struct timestamp_entry *tse;
 
-	if (!ts_table || (ts_table->num_entries == ts_table->max_entries))
+	if (!ts_table)
 		return;
 
+	if (ts_table->num_entries == ts_table->max_entries) {
+		static int warned;
+		if (!warned)
+			printf("Timestamp table full, dropping entry %d.\n", id);
+		warned = 1;
+		return;
+	}
+
 	tse = &ts_table->entries[ts_table->num_entries++];
 	tse->entry_id = id;
 	tse->entry_stamp = ts_time - ts_table->base_time;
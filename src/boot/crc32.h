@@ -17,6 +17,23 @@
 #ifndef __BOOT_CRC32_H__
 #define __BOOT_CRC32_H__
 
+/*
+ * Calculate the CRC32 of a buffer. To calculate it over data which comes in
+ * pieces, start with a crc of 0 and pass in the result for each piece.
+ */
 uint32_t crc32 (uint32_t crc, const void *p, unsigned len);
 
+/*
+ * Combine crc1, the CRC32 of some data, with crc2, the CRC32 of len2 more
+ * bytes, into the CRC32 of all of it.
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/*
+ * Continue a CRC32 over count copies of a buffer, without going through every
+ * copy.
+ */
+uint32_t crc32_repeat(uint32_t crc, const void *p, unsigned len,
+		      uint64_t count);
+
 #endif /* __BOOT_CRC32_H__ */
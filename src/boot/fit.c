@@ -30,6 +30,9 @@
 static ListNode image_nodes;
 static ListNode config_nodes;
 
+// The largest kernel device tree we're willing to decompress.
+static const size_t FitMaxFdtSize = 1 * MiB;
+
 static const char *fit_kernel_compat[10] = { NULL };
 static int num_fit_kernel_compat = 0;
 
@@ -104,6 +107,8 @@ static void config_node(DeviceTreeNode *node)
 {
 	FitConfigNode *config = xzalloc(sizeof(*config));
 	config->name = node->name;
+	config->compat_pos = -1;
+	config->compat_rank = -1;
 
 	DeviceTreeProperty *prop;
 	list_for_each(prop, node->properties, list_node) {
@@ -113,6 +118,10 @@ static void config_node(DeviceTreeNode *node)
 			config->fdt = prop->prop.data;
 		else if (!strcmp("ramdisk", prop->prop.name))
 			config->ramdisk = prop->prop.data;
+		// A copy of the FDT's compatible in the config itself saves
+		// looking inside the FDT, which may have to be decompressed.
+		else if (!strcmp("compatible", prop->prop.name))
+			config->compat = prop->prop;
 	}
 
 	list_insert_after(&config->list_node, &config_nodes);
@@ -176,6 +185,48 @@ static int fdt_find_compat(void *blob, uint32_t start_offset, FdtProperty *prop)
 	return -1;
 }
 
+/*
+ * Decompress an FDT image in place, so the configs which share it only have
+ * to decompress it once.
+ */
+static int fit_decompress_fdt(FitImageNode *fdt)
+{
+	size_t size;
+
+	if (fdt->compression == CompressionNone)
+		return 0;
+
+	void *blob = xmalloc(FitMaxFdtSize);
+	switch (fdt->compression) {
+	case CompressionLzma:
+		size = ulzman(fdt->data, fdt->size, blob, FitMaxFdtSize);
+		break;
+	case CompressionLz4:
+		size = ulz4fn(fdt->data, fdt->size, blob, FitMaxFdtSize);
+		break;
+	default:
+		size = 0;
+		break;
+	}
+
+	FdtHeader *header = (FdtHeader *)blob;
+	if (size < sizeof(*header) || betohl(header->magic) != FdtMagic ||
+	    betohl(header->totalsize) > size) {
+		printf("Failed to decompress FDT %s.\n", fdt->name);
+		free(blob);
+		return -1;
+	}
+	printf("Decompressed FDT %s to %zu bytes.\n", fdt->name, size);
+
+	// Give back the part of the buffer which wasn't needed.
+	fdt->data = realloc(blob, size);
+	if (!fdt->data)
+		fdt->data = blob;
+	fdt->size = size;
+	fdt->compression = CompressionNone;
+	return 0;
+}
+
 static int fit_check_compat(FdtProperty *compat_prop, const char *compat_name)
 {
 	int bytes = compat_prop->size;
@@ -292,11 +343,9 @@ static void update_memory(DeviceTree *tree)
 	list_for_each(node, tree->root->children, list_node) {
 		const char *devtype = dt_find_string_prop(node, "device_type");
 		if (devtype && !strcmp(devtype, "memory"))
-			list_remove(&node->list_node);
+			dt_delete_node(node);
 	}
-	node = xzalloc(sizeof(*node));
-	node->name = "memory";
-	list_insert_after(&node->list_node, &tree->root->children);
+	node = dt_add_child(tree->root, "memory");
 	dt_add_string_prop(node, "device_type", "memory");
 
 	// Read memory info from coreboot (ranges are merged automatically).
@@ -399,31 +448,31 @@ FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 			continue;
 		}
 
-		if (config->fdt_node) {
-			if (config->fdt_node->compression != CompressionNone) {
-				printf("FDT compression not yet supported, "
-				       "skipping config %s.\n", config->name);
+		// Only look inside the FDT if the config doesn't say what it's
+		// compatible with, since that may mean decompressing it.
+		if (config->fdt_node && !config->compat.name) {
+			FitImageNode *fdt = config->fdt_node;
+
+			if (fit_decompress_fdt(fdt)) {
+				printf("Skipping config %s.\n", config->name);
 				list_remove(&config->list_node);
 				continue;
 			}
 
-			void *fdt_blob = config->fdt_node->data;
-			FdtHeader *fdt_header = (FdtHeader *)fdt_blob;
-			uint32_t fdt_offset =
-				betohl(fdt_header->structure_offset);
-			config->compat_pos = -1;
-			config->compat_rank = -1;
-			if (!fdt_find_compat(fdt_blob, fdt_offset,
-					    &config->compat)) {
-				for (i = 0; i < num_fit_kernel_compat; i++) {
-					int pos = fit_check_compat(
-							&config->compat,
-							fit_kernel_compat[i]);
-					if (pos >= 0) {
-						config->compat_pos = pos;
-						config->compat_rank = i;
-						break;
-					}
+			FdtHeader *fdt_header = (FdtHeader *)fdt->data;
+			fdt_find_compat(fdt->data,
+					betohl(fdt_header->structure_offset),
+					&config->compat);
+		}
+
+		if (config->fdt_node && config->compat.name) {
+			for (i = 0; i < num_fit_kernel_compat; i++) {
+				int pos = fit_check_compat(&config->compat,
+							   fit_kernel_compat[i]);
+				if (pos >= 0) {
+					config->compat_pos = pos;
+					config->compat_rank = i;
+					break;
 				}
 			}
 		}
@@ -475,6 +524,10 @@ FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 	}
 
 	if (to_boot->fdt_node) {
+		// Only the chosen config's FDT has to be decompressed.
+		if (fit_decompress_fdt(to_boot->fdt_node))
+			return NULL;
+
 		*dt = fdt_unflatten(to_boot->fdt_node->data);
 		if (!*dt) {
 			printf("Failed to unflatten the kernel's fdt.\n");
@@ -50,15 +50,13 @@ static int ramoops_fixup(DeviceTreeFixup *fixup, DeviceTree *tree)
 	// Eliminate any existing ramoops node.
 	DeviceTreeNode *node = dt_find_compat(tree->root, "ramoops");
 	if (node)
-		list_remove(&node->list_node);
+		dt_delete_node(node);
 
 	u32 addr_cells = 1, size_cells = 1;
 	dt_read_cell_props(reserved, &addr_cells, &size_cells);
 
 	// Create a ramoops node under /reserved-memory/.
-	node = xzalloc(sizeof(*node));
-	node->name = "ramoops";
-	list_insert_after(&node->list_node, &reserved->children);
+	node = dt_add_child(reserved, "ramoops");
 
 	// Add a compatible property.
 	dt_add_string_prop(node, "compatible", "ramoops");
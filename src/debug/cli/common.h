@@ -92,4 +92,11 @@ char *getenv(const char *);
 int print_buffer(unsigned long addr, const void *data, unsigned width,
 		 unsigned count, unsigned linelen);
 
+/*
+ * Return the block device picked with "storage dev", or NULL if the storage
+ * subsystem has not been initialized.
+ */
+struct BlockDev;
+struct BlockDev *storage_current_device(void);
+
 #endif	/* __DEBUG_CLI_COMMON_H__ */
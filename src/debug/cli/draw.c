@@ -9,6 +9,7 @@
 #include <coreboot_tables.h>
 #include <vboot/screens.h>
 #include "common.h"
+#include "drivers/flash/cbfs.h"
 #include "drivers/video/display.h"
 #include "drivers/video/coreboot_fb.h"
 
@@ -38,8 +39,8 @@ static int do_draw_image(int argc, char * const argv[])
 	size_t size;
 	int rv;
 
-	bitmap = cbfs_get_file_content(CBFS_DEFAULT_MEDIA, argv[2],
-				       CBFS_TYPE_RAW, &size);
+	bitmap = cbfs_map_file(CBFS_DEFAULT_MEDIA, argv[2], CBFS_TYPE_RAW,
+			       &size);
 	if (!bitmap) {
 		printf("File '%s' not found\n", argv[2]);
 		return -1;
@@ -62,6 +63,7 @@ static int do_draw_image(int argc, char * const argv[])
 	if (rv)
 		printf("draw_bitmap returned error: %d\n", rv);
 
+	cbfs_unmap_file(bitmap);
 	return rv;
 }
 
@@ -10,7 +10,13 @@
  * Licensed under the terms of the GNU General Public License version 2 (only).
  */
 
+#include <coreboot_tables.h>
+#include <sysinfo.h>
+
+#include "base/profile.h"
+#include "base/ranges.h"
 #include "common.h"
+#include "vboot/util/memory.h"
 
 #define UL_ONEBITS 0xffffffff
 #define UL_LEN 32
@@ -469,6 +475,295 @@ struct test tests[] = {
 	{ NULL, NULL }
 };
 
+/*
+ * Fast mode. Instead of going through memory a word at a time with volatile
+ * accesses, each pass fills whole cache lines with a pattern using
+ * non-temporal stores where the architecture has them, then reads them back
+ * and compares a line at a time. Both halves are timed so the bandwidth of
+ * each pass can be reported.
+ */
+
+#define FAST_LINE_BYTES 64
+#define FAST_LINE_WORDS (FAST_LINE_BYTES / sizeof(uint64_t))
+#define FAST_MAX_REPORTS 16
+#define FAST_MAX_REGIONS 32
+
+/* Word i of a pass is (seed + i * step) ^ invert. */
+struct fast_pattern {
+	char *name;
+	uint64_t seed;
+	uint64_t step;
+	uint64_t invert;
+	int own_address;	/* Use the start of each region as the seed. */
+	int random;		/* Pick a new random seed every loop. */
+};
+
+static const struct fast_pattern fast_patterns[] = {
+	{ "Solid Zeroes", 0, 0, 0, 0, 0 },
+	{ "Solid Ones", 0, 0, ~0ULL, 0, 0 },
+	{ "Checkerboard", 0x5555555555555555ULL, 0, 0, 0, 0 },
+	{ "Inverse Checkerboard", 0x5555555555555555ULL, 0, ~0ULL, 0, 0 },
+	{ "Own Address", 0, sizeof(uint64_t), 0, 1, 0 },
+	{ "Inverse Address", 0, sizeof(uint64_t), ~0ULL, 1, 0 },
+	{ "Random Stride", 0, 0x9e3779b97f4a7c15ULL, 0, 0, 1 },
+	{ NULL }
+};
+
+struct fast_region {
+	uint64_t *buf;
+	size_t words;
+};
+
+struct fast_regions {
+	struct fast_region region[FAST_MAX_REGIONS];
+	int count;
+	uint64_t bytes;
+};
+
+static inline void fast_store2(uint64_t *p, uint64_t a, uint64_t b)
+{
+#if CONFIG_ARCH_ARM_V8
+	asm volatile("stnp %1, %2, [%0]"
+		     : : "r"(p), "r"(a), "r"(b) : "memory");
+#elif CONFIG_ARCH_X86
+	asm volatile("movnti %1, 0(%0)\n\t"
+		     "movnti %2, 4(%0)\n\t"
+		     "movnti %3, 8(%0)\n\t"
+		     "movnti %4, 12(%0)"
+		     : : "r"(p), "r"((uint32_t)a), "r"((uint32_t)(a >> 32)),
+		       "r"((uint32_t)b), "r"((uint32_t)(b >> 32))
+		     : "memory");
+#else
+	p[0] = a;
+	p[1] = b;
+#endif
+}
+
+static inline void fast_load2(const uint64_t *p, uint64_t *a, uint64_t *b)
+{
+#if CONFIG_ARCH_ARM_V8
+	asm volatile("ldnp %0, %1, [%2]"
+		     : "=r"(*a), "=r"(*b) : "r"(p) : "memory");
+#else
+	*a = p[0];
+	*b = p[1];
+#endif
+}
+
+static void fast_fill(uint64_t *buf, size_t words, uint64_t seed,
+		      uint64_t step, uint64_t invert)
+{
+	uint64_t v = seed;
+
+	for (size_t i = 0; i < words; i += FAST_LINE_WORDS) {
+		for (int j = 0; j < FAST_LINE_WORDS; j += 2) {
+			fast_store2(&buf[i + j], v ^ invert,
+				    (v + step) ^ invert);
+			v += 2 * step;
+		}
+	}
+
+	/* Make sure the data went out to memory and not just the cache. */
+#if CONFIG_ARCH_X86
+	asm volatile("sfence" : : : "memory");
+#elif CONFIG_ARCH_ARM
+	dcache_clean_invalidate_by_mva(buf, words * sizeof(uint64_t));
+#endif
+}
+
+static int fast_verify(const uint64_t *buf, size_t words, uint64_t seed,
+		       uint64_t step, uint64_t invert, int *reports)
+{
+	uint64_t v = seed;
+	int r = 0;
+
+	for (size_t i = 0; i < words; i += FAST_LINE_WORDS) {
+		uint64_t line[FAST_LINE_WORDS];
+		uint64_t diff = 0;
+
+		for (int j = 0; j < FAST_LINE_WORDS; j += 2) {
+			fast_load2(&buf[i + j], &line[j], &line[j + 1]);
+			diff |= line[j] ^ ((v + j * step) ^ invert);
+			diff |= line[j + 1] ^ ((v + (j + 1) * step) ^ invert);
+		}
+
+		if (diff) {
+			r = -1;
+			for (int j = 0; j < FAST_LINE_WORDS; j++) {
+				uint64_t expected = (v + j * step) ^ invert;
+				if (line[j] == expected ||
+				    *reports >= FAST_MAX_REPORTS)
+					continue;
+				fprintf(stderr,
+					"FAILURE: 0x%016llx != 0x%016llx at "
+					"address %p.\n", line[j], expected,
+					&buf[i + j]);
+				(*reports)++;
+			}
+		}
+		v += FAST_LINE_WORDS * step;
+	}
+	return r;
+}
+
+/* Bandwidth in GB/s with two decimal places, from bytes and microseconds. */
+static void fast_print_bandwidth(const char *what, uint64_t bytes, uint64_t us)
+{
+	uint64_t mbps = profile_mbps(bytes, us);
+
+	printf("%s %llu.%02llu GB/s", what, mbps / 1000, mbps % 1000 / 10);
+}
+
+static int fast_run(const struct fast_pattern *pat, struct fast_regions *regs,
+		    uint64_t seed)
+{
+	uint64_t fill_us = 0, verify_us = 0;
+	int reports = 0;
+	int r = 0;
+
+	for (int i = 0; i < regs->count; i++) {
+		struct fast_region *reg = &regs->region[i];
+		uint64_t start;
+
+		if (pat->own_address)
+			seed = (uintptr_t)reg->buf;
+
+		start = timer_us(0);
+		fast_fill(reg->buf, reg->words, seed, pat->step, pat->invert);
+		fill_us += timer_us(start);
+
+		start = timer_us(0);
+		if (fast_verify(reg->buf, reg->words, seed, pat->step,
+				pat->invert, &reports))
+			r = -1;
+		verify_us += timer_us(start);
+	}
+
+	printf(r ? "fail" : "ok  ");
+	fast_print_bandwidth(" (fill", regs->bytes, fill_us);
+	fast_print_bandwidth(", verify", regs->bytes, verify_us);
+	printf(")\n");
+	return r;
+}
+
+static void fast_add_region(uint64_t start, uint64_t end, void *data)
+{
+	struct fast_regions *regs = data;
+	uint64_t max_addr = (uint64_t)~(uintptr_t)0;
+	struct fast_region *reg;
+
+	/* Only memory the CPU can address directly can be tested. */
+	if (start > max_addr) {
+		printf("\t[%#016llx, %#016llx) skipped, not addressable\n",
+		       start, end);
+		return;
+	}
+	if (end - 1 > max_addr)
+		end = max_addr + 1;
+
+	start = ALIGN_UP(start, FAST_LINE_BYTES);
+	end = ALIGN_DOWN(end, FAST_LINE_BYTES);
+	if (start >= end)
+		return;
+
+	if (regs->count == FAST_MAX_REGIONS) {
+		printf("\t[%#016llx, %#016llx) skipped, too many regions\n",
+		       start, end);
+		return;
+	}
+
+	printf("\t[%#016llx, %#016llx)\n", start, end);
+	reg = &regs->region[regs->count++];
+	reg->buf = (uint64_t *)(uintptr_t)start;
+	reg->words = (end - start) / sizeof(uint64_t);
+	regs->bytes += end - start;
+}
+
+/* Find all the RAM outside of depthcharge itself that nothing else owns. */
+static int fast_free_regions(struct fast_regions *regs)
+{
+	Ranges ranges;
+
+	ranges_init(&ranges);
+	for (int i = 0; i < lib_sysinfo.n_memranges; i++) {
+		struct memrange *range = &lib_sysinfo.memrange[i];
+		uint64_t start = range->base;
+		uint64_t end = range->base + range->size;
+
+		if (range->type == CB_MEM_RAM)
+			ranges_add(&ranges, start, end);
+		else
+			ranges_sub(&ranges, start, end);
+	}
+	// Leave depthcharge and the buffers it handed out (ramoops) alone.
+	memory_remove_used(&ranges);
+
+	printf("Testing regions:\n");
+	ranges_for_each(&ranges, &fast_add_region, regs);
+	ranges_teardown(&ranges);
+
+	if (!regs->count) {
+		printf("No memory to test.\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int do_fast_memtest(int argc, char *const argv[])
+{
+	struct fast_regions regs = { .count = 0 };
+	const struct fast_pattern *pat;
+	int loop, loops = 1;
+	int rc = CMD_RET_SUCCESS;
+
+	if (argc > 2 && !strcmp(argv[2], "all")) {
+		if (fast_free_regions(&regs))
+			return CMD_RET_FAILURE;
+		if (argc > 3)
+			loops = strtoul(argv[3], 0, 16);
+	} else if (argc > 3) {
+		ul start = strtoul(argv[2], 0, 16);
+		ul length = strtoul(argv[3], 0, 16);
+
+		if (start == 0 || length == 0) {
+			printf("Invalid start address\n");
+			return CMD_RET_USAGE;
+		}
+		printf("Testing regions:\n");
+		fast_add_region(start, (uint64_t)start + length, &regs);
+		if (!regs.count) {
+			printf("Range too small\n");
+			return CMD_RET_USAGE;
+		}
+		if (argc > 4)
+			loops = strtoul(argv[4], 0, 16);
+	} else {
+		printf("Required command line parameters missing\n");
+		return CMD_RET_USAGE;
+	}
+
+	printf("%llu MiB in %d region(s)\n", regs.bytes / MiB, regs.count);
+
+	for (loop = 1; loop <= loops; loop++) {
+		uint64_t start = timer_us(0);
+
+		printf("Loop %lu/%lu:\n", (ul)loop, (ul)loops);
+		for (pat = fast_patterns; pat->name; pat++) {
+			uint64_t seed = pat->random ?
+				((uint64_t)rand_ul() << 32 | rand_ul()) :
+				pat->seed;
+
+			printf("  %-25s: ", pat->name);
+			if (fast_run(pat, &regs, seed))
+				rc = CMD_RET_FAILURE;
+		}
+		printf("  Took %llu ms\n", timer_us(start) / 1000);
+	}
+	printf("\nDone.\n");
+
+	return rc;
+}
+
 static int do_memtest(cmd_tbl_t *cmdtp, int flag, int argc, char *const argv[])
 {
 	struct test *t;
@@ -478,6 +773,9 @@ static int do_memtest(cmd_tbl_t *cmdtp, int flag, int argc, char *const argv[])
 	int rc;
 	int loop, loops = 1;
 
+	if (argc > 1 && !strcmp(argv[1], "fast"))
+		return do_fast_memtest(argc, argv);
+
 	if (argc < 3) {
 		printf("Required command line parameters missing\n");
 		return CMD_RET_USAGE;
@@ -527,7 +825,10 @@ static int do_memtest(cmd_tbl_t *cmdtp, int flag, int argc, char *const argv[])
 }
 
 U_BOOT_CMD(
-	   memtest,	4,	1,
+	   memtest,	5,	1,
 	   "basic memory test",
-	   "\n<start> <length> [loops]  -  test a range of memory"
+	   "\n<start> <length> [loops]  -  test a range of memory\n"
+	   "memtest fast <start> <length> [loops]  -  test a range of memory\n"
+	   "    a cache line at a time, reporting bandwidth\n"
+	   "memtest fast all [loops]  -  fast test all free memory"
 );
@@ -67,3 +67,48 @@ U_BOOT_CMD(
 	"The IP address and boot file can take the \"dhcp\" special value\n"
 	"to send DHCP requests rather than using static values."
 );
+
+int do_tftpinstall(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
+{
+	char *address;
+	char *file;
+	uip_ipaddr_t tftp_ip;
+	uip_ipaddr_t *tftp_ip_arg;
+	BlockDev *dev;
+
+	if (argc != 4)
+		return CMD_RET_USAGE;
+
+	address = argv[1];
+	file = (!strcmp(argv[2], DHCP)) ? NULL : argv[2];
+
+	if (!strcmp(address, DHCP)) {
+		tftp_ip_arg = NULL;
+	} else if (!uiplib_ipaddrconv(address, &tftp_ip)) {
+		printf("Invalid IPv4 address: %s\n", address);
+		return CMD_RET_USAGE;
+	} else {
+		tftp_ip_arg = &tftp_ip;
+	}
+
+	dev = storage_current_device();
+	if (!dev) {
+		printf("Is storage subsystem initialized?\n");
+		return CMD_RET_FAILURE;
+	}
+
+	if (netboot_install(tftp_ip_arg, file, dev, strtoull(argv[3], NULL, 0)))
+		return CMD_RET_FAILURE;
+
+	return CMD_RET_SUCCESS;
+}
+
+U_BOOT_CMD(
+	tftpinstall,	4,	1,
+	"write a file to storage via network using TFTP protocol",
+	"[host IP addr] [file] [base block]\n"
+	"\n"
+	"The file is written to the device selected with \"storage dev\",\n"
+	"as it arrives. The IP address and file can take the \"dhcp\"\n"
+	"special value to send DHCP requests rather than using static values."
+);
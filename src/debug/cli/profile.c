@@ -0,0 +1,39 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "base/profile.h"
+#include "common.h"
+
+static int do_profile(cmd_tbl_t *cmdtp, int flag, int argc,
+		      char * const argv[])
+{
+	if (argc == 1) {
+		profile_dump();
+		return CMD_RET_SUCCESS;
+	}
+
+	if (argc == 2 && !strcmp(argv[1], "reset")) {
+		profile_reset();
+		return CMD_RET_SUCCESS;
+	}
+
+	return CMD_RET_USAGE;
+}
+
+U_BOOT_CMD(
+	profile,	2,	1,
+	"show boot phase profile",
+	"\n"
+	" - print the recorded spans\n"
+	" reset - forget the recorded spans"
+);
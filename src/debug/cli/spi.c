@@ -69,6 +69,28 @@ static int do_spi_write(int argc, char * const argv[], int read_flag)
 	return length != flash_write(offset, length, mem_addr);
 }
 
+static int do_spi_cache(int argc, char * const argv[], int ignore)
+{
+	uint32_t hits, misses, valid;
+
+	if (argc == 1 && !strcmp(argv[0], "flush")) {
+		flash_cache_invalidate();
+		return 0;
+	}
+
+	if (argc)
+		return CMD_RET_USAGE;
+
+	if (flash_cache_stats(&hits, &misses, &valid)) {
+		printf("flash driver has no read cache\n");
+		return 0;
+	}
+
+	printf("read cache: %u hits, %u misses, %u bytes valid\n",
+	       hits, misses, valid);
+	return 0;
+}
+
 static int do_spi(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 {
 	struct {
@@ -79,7 +101,8 @@ static int do_spi(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 		{"read", 1, do_spi_read},
 		{"dump", 0, do_spi_read},
 		{"erase", 1, do_spi_erase},
-		{"write", 0, do_spi_write}
+		{"write", 0, do_spi_write},
+		{"cache", 0, do_spi_cache}
 	};
 	int i;
 
@@ -104,4 +127,6 @@ U_BOOT_CMD(
 	"                           into RAM starting at 'addr'\n"
 	"spi write offset len addr - write 'len' bytes starting at 'offset'\n"
 	"                           from RAM starting at 'addr'\n"
+	"spi cache [flush]        - show read cache hit/miss counters or\n"
+	"                           drop all cached ranges\n"
 );
@@ -4,8 +4,10 @@
  */
 
 #include "base/list.h"
+#include "base/profile.h"
 #include "debug/cli/common.h"
 #include "drivers/storage/blockdev.h"
+#include "drivers/storage/bouncebuf.h"
 #include <vboot_api.h>
 #include <gpt.h>
 #include <gpt_misc.h>
@@ -22,6 +24,15 @@ typedef struct {
 
 static storage_devices current_devices;
 
+BlockDev *storage_current_device(void)
+{
+	if ((current_devices.curr_device < 0) ||
+	    (current_devices.curr_device >= current_devices.total))
+		return NULL;
+
+	return current_devices.known_devices[current_devices.curr_device];
+}
+
 static int storage_show(int argc, char *const argv[])
 {
 	int i;
@@ -257,6 +268,215 @@ static int storage_init(int argc, char *const argv[])
 	return storage_show(0, NULL);
 }
 
+/* Defaults for storage bench, and the largest queue it will build. */
+#define BENCH_DEFAULT_BYTES	(64 * MiB)
+#define BENCH_MAX_QDEPTH	32
+
+typedef struct {
+	BlockDevRequest req[BENCH_MAX_QDEPTH];
+	uint64_t submitted[BENCH_MAX_QDEPTH];
+	int busy[BENCH_MAX_QDEPTH];
+	uint8_t *buffer[BENCH_MAX_QDEPTH];
+	/* Latency in microseconds of each finished operation. */
+	uint32_t *latency;
+	int done;
+	int failed;
+} storage_bench_state;
+
+static void storage_bench_done(BlockDevRequest *req)
+{
+	storage_bench_state *state = req->data;
+	int slot = req - state->req;
+
+	state->latency[state->done++] = timer_us(state->submitted[slot]);
+	state->busy[slot] = 0;
+	if (req->status)
+		state->failed = 1;
+}
+
+static lba_t storage_bench_next(int random, lba_t *seq, lba_t base,
+				lba_t span, lba_t blocks)
+{
+	lba_t start;
+
+	if (random) {
+		uint64_t r = (uint64_t)rand() << 31 | rand();
+		return base + (r % (span / blocks)) * blocks;
+	}
+
+	if (*seq + blocks > base + span)
+		*seq = base;
+	start = *seq;
+	*seq += blocks;
+	return start;
+}
+
+/* A Shell sort is plenty fast for a few thousand latencies. */
+static void storage_bench_sort(uint32_t *vals, int count)
+{
+	for (int gap = count / 2; gap > 0; gap /= 2) {
+		for (int i = gap; i < count; i++) {
+			uint32_t val = vals[i];
+			int j;
+
+			for (j = i; j >= gap && vals[j - gap] > val; j -= gap)
+				vals[j] = vals[j - gap];
+			vals[j] = val;
+		}
+	}
+}
+
+static int storage_bench(int argc, char *const argv[])
+{
+	BlockDev *bd = storage_current_device();
+	storage_bench_state state;
+	lba_t blocks, total, base, span, seq;
+	int is_write = 0, is_erase = 0, random;
+	int qdepth = 1, ops;
+	uint64_t start_us, elapsed_us, bytes;
+
+	if (!bd) {
+		printf("Is storage subsystem initialized?\n");
+		return CMD_RET_FAILURE;
+	}
+
+	if (!strcmp(argv[0], "write"))
+		is_write = 1;
+	else if (!strcmp(argv[0], "erase"))
+		is_erase = 1;
+	else if (strcmp(argv[0], "read"))
+		return CMD_RET_USAGE;
+
+	if (!strcmp(argv[1], "rand"))
+		random = 1;
+	else if (!strcmp(argv[1], "seq"))
+		random = 0;
+	else
+		return CMD_RET_USAGE;
+
+	blocks = strtoull(argv[2], NULL, 0);
+	if (argc > 3)
+		qdepth = strtoul(argv[3], NULL, 0);
+	total = argc > 4 ? strtoull(argv[4], NULL, 0) :
+			   BENCH_DEFAULT_BYTES / bd->block_size;
+	base = argc > 5 ? strtoull(argv[5], NULL, 0) : 0;
+
+	// Don't let a destructive bench default to the start of the device,
+	// where the partition table lives.
+	if ((is_write || is_erase) && argc <= 5) {
+		printf("%s bench needs an explicit base block\n", argv[0]);
+		return CMD_RET_FAILURE;
+	}
+	if (base >= bd->block_count) {
+		printf("Base block past the end of %s\n", bd->name);
+		return CMD_RET_FAILURE;
+	}
+	span = bd->block_count - base;
+	if (!blocks || blocks > span || total < blocks) {
+		printf("Bad transfer size\n");
+		return CMD_RET_FAILURE;
+	}
+	if (qdepth < 1 || qdepth > BENCH_MAX_QDEPTH) {
+		printf("Queue depth must be 1 to %d\n", BENCH_MAX_QDEPTH);
+		return CMD_RET_FAILURE;
+	}
+	if (is_erase && !bd->ops.erase) {
+		printf("Erase not applicable to %s\n", bd->name);
+		return CMD_RET_FAILURE;
+	}
+	// Erases are synchronous only.
+	if (is_erase)
+		qdepth = 1;
+
+	ops = total / blocks;
+	memset(&state, 0, sizeof(state));
+	state.latency = xmalloc(ops * sizeof(*state.latency));
+	for (int i = 0; !is_erase && i < qdepth; i++) {
+		state.buffer[i] = xmemalign(ARCH_DMA_MINALIGN,
+					    blocks * bd->block_size);
+		for (size_t j = 0; is_write && j < blocks * bd->block_size;
+		     j++)
+			state.buffer[i][j] = rand();
+	}
+
+	printf("%s %s on %s: %d ops of %lld blocks (%lld bytes), qd %d\n",
+	       argv[0], argv[1], bd->name, ops, blocks,
+	       blocks * bd->block_size, qdepth);
+
+	seq = base;
+	start_us = timer_us(0);
+	if (is_erase) {
+		for (int i = 0; i < ops && !state.failed; i++) {
+			lba_t start = storage_bench_next(random, &seq, base,
+							 span, blocks);
+			uint64_t op_us = timer_us(0);
+
+			if (bd->ops.erase(&bd->ops, start, blocks) != blocks)
+				state.failed = 1;
+			state.latency[state.done++] = timer_us(op_us);
+		}
+	} else {
+		int issued = 0;
+
+		while (state.done < ops && !state.failed) {
+			// Keep every free slot of the queue busy.
+			for (int slot = 0; slot < qdepth && issued < ops;
+			     slot++) {
+				BlockDevRequest *req = &state.req[slot];
+
+				if (state.busy[slot])
+					continue;
+
+				req->is_write = is_write;
+				req->start = storage_bench_next(
+					random, &seq, base, span, blocks);
+				req->count = blocks;
+				req->buffer = state.buffer[slot];
+				req->complete = &storage_bench_done;
+				req->data = &state;
+				state.submitted[slot] = timer_us(0);
+				if (blockdev_submit(&bd->ops, req)) {
+					state.failed = 1;
+					break;
+				}
+				state.busy[slot] = 1;
+				issued++;
+			}
+
+			// Wait for at least one request to free up its slot.
+			blockdev_poll(&bd->ops, 1);
+		}
+		blockdev_drain(&bd->ops);
+	}
+	elapsed_us = MAX(timer_us(start_us), 1);
+
+	bytes = (uint64_t)state.done * blocks * bd->block_size;
+	printf("  %lld ms, %lld IOPS, %lld.%02lld MB/s\n",
+	       elapsed_us / 1000, state.done * 1000000ULL / elapsed_us,
+	       profile_mbps(bytes, elapsed_us),
+	       profile_mbps(bytes * 100, elapsed_us) % 100);
+
+	if (state.done) {
+		storage_bench_sort(state.latency, state.done);
+		printf("  latency us: min %u, p50 %u, p90 %u, p99 %u, "
+		       "max %u\n", state.latency[0],
+		       state.latency[state.done * 50 / 100],
+		       state.latency[state.done * 90 / 100],
+		       state.latency[state.done * 99 / 100],
+		       state.latency[state.done - 1]);
+	}
+
+	for (int i = 0; i < qdepth; i++)
+		free(state.buffer[i]);
+	free(state.latency);
+
+	if (state.failed) {
+		printf("  %s failed\n", argv[0]);
+		return CMD_RET_FAILURE;
+	}
+	return CMD_RET_SUCCESS;
+}
+
 typedef struct {
 	const char *subcommand_name;
 	int (*subcmd)(int argc, char *const argv[]);
@@ -272,6 +492,7 @@ static const cmd_map cmdmap[] = {
 	{ "write", storage_write, 3, 3 },
 	{ "erase", storage_erase, 2, 2 },
 	{ "part", storage_part, 0, 0 },
+	{ "bench", storage_bench, 3, 6 },
 };
 
 static int do_storage(cmd_tbl_t *cmdtp, int flag,
@@ -296,6 +517,9 @@ U_BOOT_CMD(
 	storage, CONFIG_SYS_MAXARGS,	1,
 	"command for controlling onboard storage devices",
 	"\n"
+	" bench <read|write|erase> <seq|rand> <blks per op> [queue depth]\n"
+	"       [total blks] [base blk] - benchmark default device,\n"
+	"       base blk is required for write and erase\n"
 	" dev [dev#] - display or set default storage device\n"
 	" erase <base blk> <num blks> - erase in default device\n"
 	" init - initialize storage devices\n"
@@ -15,6 +15,7 @@
  * GNU General Public License for more details.
  */
 
+#include <assert.h>
 #include <endian.h>
 #include <libpayload.h>
 
@@ -73,6 +74,21 @@
 #define PS_FW_RD_CHUNK		16
 #define PS_FW_WR_CHUNK		12
 
+/*
+ * register accesses are batched into as few EC I2C passthru commands
+ * as possible. each write is its own 2 byte message, each read a
+ * 1 byte write message plus a 1 byte read message. stay within the
+ * smallest param size any EC host protocol version supports.
+ */
+
+#define PS_PASSTHRU_BYTES	(EC_PROTO2_MAX_PARAM_SIZE - \
+				 sizeof(struct ec_params_i2c_passthru))
+#define PS_PASSTHRU_MSG_BYTES	sizeof(struct ec_params_i2c_passthru_msg)
+#define PS_BATCH_WRITES		(PS_PASSTHRU_BYTES / \
+				 (PS_PASSTHRU_MSG_BYTES + 2))
+#define PS_BATCH_READS		(PS_PASSTHRU_BYTES / \
+				 (2 * PS_PASSTHRU_MSG_BYTES + 1))
+
 #define SPI_CMD_WRITE_STATUS_REG	0x01
 #define SPI_CMD_PROG_PAGE		0x02
 #define SPI_CMD_READ_DATA		0x03
@@ -159,7 +175,8 @@ static int __must_check write_reg(Ps8751 *me,
 }
 
 /**
- * issue a series of i2c writes
+ * issue a series of i2c writes, batching as many as fit into each
+ * EC I2C passthru command
  *
  * @param me	device context
  * @param cmds	vector of i2c reg write commands
@@ -170,7 +187,24 @@ static int __must_check write_reg(Ps8751 *me,
 static int __must_check write_regs(Ps8751 *me, uint8_t chip,
 				   const I2cWriteVec *cmds, const size_t count)
 {
-	return i2c_write_regs(&me->bus->ops, chip, cmds, count);
+	I2cSeg seg[PS_BATCH_WRITES];
+	uint8_t buf[PS_BATCH_WRITES][2];
+	size_t done, batch, i;
+
+	for (done = 0; done < count; done += batch) {
+		batch = MIN(count - done, PS_BATCH_WRITES);
+		for (i = 0; i < batch; ++i) {
+			buf[i][0] = cmds[done + i].reg;
+			buf[i][1] = cmds[done + i].val;
+			seg[i].read = 0;
+			seg[i].chip = chip;
+			seg[i].buf = buf[i];
+			seg[i].len = sizeof(buf[i]);
+		}
+		if (me->bus->ops.transfer(&me->bus->ops, seg, batch) != 0)
+			return -1;
+	}
+	return 0;
 }
 
 /**
@@ -190,7 +224,8 @@ static int __must_check read_reg(Ps8751 *me,
 }
 
 /**
- * issue a series of i2c reads
+ * issue a series of i2c reads, batching as many as fit into each
+ * EC I2C passthru command
  *
  * @param me	device context
  * @param regs	vector of i2c regs to read read
@@ -205,7 +240,46 @@ static int __must_check read_regs(Ps8751 *me,
 				  const size_t count,
 				  uint8_t *data)
 {
-	return i2c_read_regs(&me->bus->ops, chip, regs, count, data);
+	I2cSeg seg[2 * PS_BATCH_READS];
+	uint8_t reg[PS_BATCH_READS];
+	size_t done, batch, i;
+
+	for (done = 0; done < count; done += batch) {
+		batch = MIN(count - done, PS_BATCH_READS);
+		for (i = 0; i < batch; ++i) {
+			reg[i] = regs[done + i];
+			seg[2 * i].read = 0;
+			seg[2 * i].chip = chip;
+			seg[2 * i].buf = &reg[i];
+			seg[2 * i].len = 1;
+			seg[2 * i + 1].read = 1;
+			seg[2 * i + 1].chip = chip;
+			seg[2 * i + 1].buf = &data[done + i];
+			seg[2 * i + 1].len = 1;
+		}
+		if (me->bus->ops.transfer(&me->bus->ops, seg, 2 * batch) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * read bytes out of the SPI read FIFO
+ *
+ * @param me	device context
+ * @param data	pointer to read bytes
+ * @param count	number of bytes to read, at most PS_FW_RD_CHUNK
+ * @return 0 if ok, -1 on error
+ */
+
+static int __must_check read_rd_fifo(Ps8751 *me, uint8_t *data, size_t count)
+{
+	static const uint8_t rd_fifo[PS_FW_RD_CHUNK] = {
+		[0 ... PS_FW_RD_CHUNK - 1] = P2_RD_FIFO
+	};
+
+	assert(count <= ARRAY_SIZE(rd_fifo));
+	return read_regs(me, SLAVE2, rd_fifo, count, data);
 }
 
 /**
@@ -836,6 +910,22 @@ static int __must_check ps8751_is_fw_compatible(Ps8751 *me, const uint8_t *fw)
 	return 0;
 }
 
+/**
+ * fill in the FIFO writes for a SPI command plus a 24 bit addr
+ *
+ * @param sa	4 element vector to fill in
+ * @cmd		SPI command to issue
+ * @param a24	SPI command address bits (24)
+ */
+
+static void ps8751_spi_fill_cmd24(I2cWriteVec *sa, uint8_t cmd, uint32_t a24)
+{
+	sa[0] = (I2cWriteVec){ P2_WR_FIFO, cmd };
+	sa[1] = (I2cWriteVec){ P2_WR_FIFO, a24 >> 16 };
+	sa[2] = (I2cWriteVec){ P2_WR_FIFO, a24 >>  8 };
+	sa[3] = (I2cWriteVec){ P2_WR_FIFO, a24 };
+}
+
 /**
  * write a SPI command plus a 24 bit addr to the SPI interface FIFO
  *
@@ -848,12 +938,9 @@ static int __must_check ps8751_is_fw_compatible(Ps8751 *me, const uint8_t *fw)
 static int __must_check ps8751_spi_setup_cmd24(Ps8751 *me,
 					       uint8_t cmd, uint32_t a24)
 {
-	const I2cWriteVec sa[] = {
-		{ P2_WR_FIFO, cmd },
-		{ P2_WR_FIFO, a24 >> 16 },
-		{ P2_WR_FIFO, a24 >>  8 },
-		{ P2_WR_FIFO, a24 },
-	};
+	I2cWriteVec sa[4];
+
+	ps8751_spi_fill_cmd24(sa, cmd, a24);
 	return write_regs(me, SLAVE2, sa, ARRAY_SIZE(sa));
 }
 
@@ -956,23 +1043,23 @@ static int __must_check ps8751_program(Ps8751 *me,
 		if (ps8751_spi_cmd_enable_writes(me) != 0)
 			return -1;
 
-		if (ps8751_spi_setup_cmd24(me,
-					   SPI_CMD_PROG_PAGE,
-					   fw_start + data_offset) != 0) {
-			return -1;
-		}
-		for (int i = 0; i < chunk; ++i) {
-			if (write_reg(me, SLAVE2,
-				      P2_WR_FIFO, data[data_offset + i]) != 0)
-				return -1;
-		}
-
-		const I2cWriteVec wr[] = {
-			{ P2_SPI_LEN, (4 + chunk - 1) },
-			{ P2_SPI_CTRL,
-			  P2_SPI_CTRL_NOREAD|P2_SPI_CTRL_TRIGGER },
-		};
-		if (write_regs(me, SLAVE2, wr, ARRAY_SIZE(wr)) != 0)
+		/*
+		 * the address, the data and the trigger all go to the
+		 * chip in one batch
+		 */
+		I2cWriteVec wr[4 + PS_FW_WR_CHUNK + 2];
+		int n = 0;
+
+		ps8751_spi_fill_cmd24(wr, SPI_CMD_PROG_PAGE,
+				      fw_start + data_offset);
+		n += 4;
+		for (int i = 0; i < chunk; ++i)
+			wr[n++] = (I2cWriteVec){ P2_WR_FIFO,
+						 data[data_offset + i] };
+		wr[n++] = (I2cWriteVec){ P2_SPI_LEN, (4 + chunk - 1) };
+		wr[n++] = (I2cWriteVec){ P2_SPI_CTRL,
+					 P2_SPI_CTRL_NOREAD|P2_SPI_CTRL_TRIGGER };
+		if (write_regs(me, SLAVE2, wr, n) != 0)
 			return -1;
 		if (ps8751_spi_fifo_wait_busy(me) != 0)
 			return -1;
@@ -1001,7 +1088,7 @@ static int __must_check ps8751_verify(Ps8751 *me,
 				      const uint8_t *data, size_t data_size)
 {
 	uint64_t deadline = 0;
-	uint8_t readback;
+	uint8_t readback[PS_FW_RD_CHUNK];
 	uint64_t t0_us;
 	uint32_t data_offset;
 	int chunk;
@@ -1016,29 +1103,27 @@ static int __must_check ps8751_verify(Ps8751 *me,
 
 		if (ps8751_keep_awake(me, &deadline) != 0)
 			return -1;
-		if (ps8751_spi_setup_cmd24(me, SPI_CMD_READ_DATA,
-					   fw_addr + data_offset) != 0) {
-			return -1;
-		}
 
-		const I2cWriteVec rd[] = {
-			{ P2_SPI_LEN,
-			  ((chunk - 1) << 4) | (4 - 1) },
-			{ P2_SPI_CTRL, P2_SPI_CTRL_TRIGGER },
-		};
+		I2cWriteVec rd[4 + 2];
+
+		ps8751_spi_fill_cmd24(rd, SPI_CMD_READ_DATA,
+				      fw_addr + data_offset);
+		rd[4] = (I2cWriteVec){ P2_SPI_LEN,
+				       ((chunk - 1) << 4) | (4 - 1) };
+		rd[5] = (I2cWriteVec){ P2_SPI_CTRL, P2_SPI_CTRL_TRIGGER };
 		if (write_regs(me, SLAVE2, rd, ARRAY_SIZE(rd)) != 0)
 			return -1;
 		if (ps8751_spi_fifo_wait_busy(me) != 0)
 			return -1;
+		if (read_rd_fifo(me, readback, chunk) != 0)
+			return -1;
 		for (int i = 0; i < chunk; ++i) {
-			if (read_reg(me, SLAVE2, P2_RD_FIFO, &readback) != 0)
-				return -1;
-			if (readback != data[data_offset + i]) {
+			if (readback[i] != data[data_offset + i]) {
 				printf("%s: mismatch at offset 0x%06x "
 				       "0x%02x != 0x%02x (expected)\n",
 				       me->chip_name,
 				       fw_addr + data_offset + i,
-				       readback, data[data_offset + i]);
+				       readback[i], data[data_offset + i]);
 				return -1;
 			}
 		}
@@ -1126,11 +1211,7 @@ static void ps8751_dump_flash(Ps8751 *me,
 		if (ps8751_spi_fifo_wait_busy(me) != 0)
 			return;
 
-		for (i = 0; i < sizeof(buf); ++i) {
-			if (read_reg(me, SLAVE2, P2_RD_FIFO, &buf[i]) != 0)
-				break;
-		}
-		if (i != sizeof(buf))
+		if (read_rd_fifo(me, buf, sizeof(buf)) != 0)
 			break;
 
 		if (offset > offset_start &&
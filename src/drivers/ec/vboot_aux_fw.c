@@ -19,9 +19,17 @@
 
 #include <cbfs.h>
 
+#include "base/profile.h"
+#include "drivers/flash/cbfs.h"
+
 static struct {
 	const VbootAuxFwOps *fw_ops;
 	VbAuxFwUpdateSeverity_t severity;
+	/*
+	 * Set once the device is known to match its bundled hash (or to be
+	 * absent), so later checks this boot don't go back to the chip.
+	 */
+	int up_to_date;
 } vboot_aux_fw[NUM_MAX_VBOOT_AUX_FW];
 
 static int vboot_aux_fw_count = 0;
@@ -60,17 +68,26 @@ static VbError_t check_dev_fw_hash(const VbootAuxFwOps *aux_fw,
 {
 	const void *want_hash;
 	size_t want_size;
+	VbError_t status;
+	uint64_t start;
+	int span;
 
 	/* find bundled fw hash */
-	want_hash = cbfs_get_file_content(
-		CBFS_DEFAULT_MEDIA,
-		aux_fw->fw_hash_name, CBFS_TYPE_RAW, &want_size);
+	want_hash = cbfs_map_file(CBFS_DEFAULT_MEDIA, aux_fw->fw_hash_name,
+				  CBFS_TYPE_RAW, &want_size);
 	if (want_hash == NULL) {
 		printf("%s missing from CBFS\n", aux_fw->fw_hash_name);
 		return VBERROR_UNKNOWN;
 	}
 
-	return aux_fw->check_hash(aux_fw, want_hash, want_size, severity);
+	span = profile_begin("aux fw check", aux_fw->check_hash);
+	start = timer_us(0);
+	status = aux_fw->check_hash(aux_fw, want_hash, want_size, severity);
+	printf("Checked %s in %llu ms\n", aux_fw->fw_hash_name,
+	       timer_us(start) / 1000);
+	profile_end(span);
+	cbfs_unmap_file(want_hash);
+	return status;
 }
 
 /**
@@ -92,11 +109,18 @@ VbError_t check_vboot_aux_fw(VbAuxFwUpdateSeverity_t *severity)
 		const VbootAuxFwOps *const aux_fw = vboot_aux_fw[i].fw_ops;
 		int protect_status;
 
+		if (vboot_aux_fw[i].up_to_date) {
+			max = MAX(max, vboot_aux_fw[i].severity);
+			continue;
+		}
+
 		status = check_dev_fw_hash(aux_fw, &current);
 		if (status != VBERROR_SUCCESS)
 			return status;
 
 		vboot_aux_fw[i].severity = current;
+		vboot_aux_fw[i].up_to_date = current == VB_AUX_FW_NO_DEVICE ||
+					     current == VB_AUX_FW_NO_UPDATE;
 		max = MAX(max, current);
 
 		if (current == VB_AUX_FW_NO_DEVICE ||
@@ -130,16 +154,26 @@ static VbError_t apply_dev_fw(const VbootAuxFwOps *aux_fw)
 {
 	const uint8_t *want_data;
 	size_t want_size;
+	VbError_t status;
+	uint64_t start;
+	int span;
 
 	/* find bundled fw */
-	want_data = cbfs_get_file_content(
-		CBFS_DEFAULT_MEDIA,
-		aux_fw->fw_image_name, CBFS_TYPE_RAW, &want_size);
+	want_data = cbfs_map_file(CBFS_DEFAULT_MEDIA, aux_fw->fw_image_name,
+				  CBFS_TYPE_RAW, &want_size);
 	if (want_data == NULL) {
 		printf("%s missing from CBFS\n", aux_fw->fw_image_name);
 		return VBERROR_UNKNOWN;
 	}
-	return aux_fw->update_image(aux_fw, want_data, want_size);
+
+	span = profile_begin("aux fw update", aux_fw->update_image);
+	start = timer_us(0);
+	status = aux_fw->update_image(aux_fw, want_data, want_size);
+	printf("Wrote %zu bytes of %s in %llu ms (status %#x)\n", want_size,
+	       aux_fw->fw_image_name, timer_us(start) / 1000, status);
+	profile_end_bytes(span, want_size);
+	cbfs_unmap_file(want_data);
+	return status;
 }
 
 /**
@@ -157,6 +191,13 @@ VbError_t update_vboot_aux_fw(void)
 	int power_button_disabled = 0;
 	int lid_shutdown_disabled = 0;
 	VbootEcOps *ec = vboot_get_ec(PRIMARY_VBOOT_EC);
+	int pending = 0;
+	int done = 0;
+
+	for (int i = 0; i < vboot_aux_fw_count; ++i)
+		if (vboot_aux_fw[i].severity != VB_AUX_FW_NO_DEVICE &&
+		    vboot_aux_fw[i].severity != VB_AUX_FW_NO_UPDATE)
+			pending++;
 
 	for (int i = 0; i < vboot_aux_fw_count; ++i) {
 		const VbootAuxFwOps *aux_fw;
@@ -185,7 +226,8 @@ VbError_t update_vboot_aux_fw(void)
 			}
 
 			/* Apply update */
-			printf("Update aux fw %d\n", i);
+			printf("Update aux fw %d (%d of %d)\n", i, ++done,
+			       pending);
 			status = apply_dev_fw(aux_fw);
 			if (status == VBERROR_PERIPHERAL_BUSY)
 				goto update_protect;
@@ -200,6 +242,8 @@ VbError_t update_vboot_aux_fw(void)
 				status = VBERROR_UNKNOWN;
 				break;
 			}
+			vboot_aux_fw[i].severity = severity;
+			vboot_aux_fw[i].up_to_date = 1;
 		}
 
 update_protect:
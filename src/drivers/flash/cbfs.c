@@ -18,7 +18,9 @@
 #include <libpayload.h>
 #include <cbfs.h>
 #include <cbfs_ram.h>
+#include "base/list.h"
 #include "image/fmap.h"
+#include "drivers/flash/cbfs.h"
 #include "drivers/flash/flash.h"
 
 /* flash as CBFS media. */
@@ -156,3 +158,60 @@ int cbfs_media_from_fmap(const char *area_name, struct cbfs_media *media)
 
 	return 0;
 }
+
+/* Heap buffers handed out by cbfs_map_file() for compressed files. */
+typedef struct {
+	const void *data;
+	ListNode list_node;
+} CbfsFileCopy;
+
+static ListNode cbfs_file_copies;
+
+const void *cbfs_map_file(struct cbfs_media *media, const char *name,
+			  int type, size_t *size)
+{
+	struct cbfs_file *file;
+	struct cbfs_file_attr_compression *comp;
+	CbfsFileCopy *copy;
+
+	file = cbfs_get_file(media, name);
+	if (!file)
+		return NULL;
+
+	if (ntohl(file->type) != type) {
+		printf("%s: '%s' has type %#x, expected %#x.\n", __func__,
+		       name, ntohl(file->type), type);
+		return NULL;
+	}
+
+	comp = cbfs_get_attr(file, CBFS_FILE_ATTR_TAG_COMPRESSION);
+	if (!comp || ntohl(comp->compression) == CBFS_COMPRESS_NONE) {
+		*size = ntohl(file->len);
+		return CBFS_SUBHEADER(file);
+	}
+
+	/* Compressed files need somewhere to be decompressed to. */
+	copy = xzalloc(sizeof(*copy));
+	copy->data = cbfs_get_file_content(media, name, type, size);
+	if (!copy->data) {
+		free(copy);
+		return NULL;
+	}
+	list_insert_after(&copy->list_node, &cbfs_file_copies);
+	return copy->data;
+}
+
+void cbfs_unmap_file(const void *data)
+{
+	CbfsFileCopy *copy;
+
+	/* Direct mappings of flash and RAM media need no cleanup. */
+	list_for_each(copy, cbfs_file_copies, list_node) {
+		if (copy->data != data)
+			continue;
+		list_remove(&copy->list_node);
+		free((void *)copy->data);
+		free(copy);
+		return;
+	}
+}
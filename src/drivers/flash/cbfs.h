@@ -18,6 +18,8 @@
 #ifndef __DRIVERS_FLASH_CBFS_H__
 #define __DRIVERS_FLASH_CBFS_H__
 
+#include <stddef.h>
+
 struct cbfs_media;
 
 /* Return a cbfs_media structure representing the RO CBFS -- NULL on error. */
@@ -32,4 +34,28 @@ struct cbfs_media *cbfs_ro_media(void);
  */
 int cbfs_media_from_fmap(const char *area_name, struct cbfs_media *media);
 
+/**
+ * cbfs_map_file() - Get at the contents of a CBFS file without copying it
+ *
+ * Uncompressed files are returned as a pointer straight into the media (the
+ * flash driver cache, memory mapped flash or a RAM CBFS), so the data must be
+ * treated as read-only. Compressed files are decompressed into a heap buffer.
+ * Either way the result must be released with cbfs_unmap_file().
+ *
+ * @media:	CBFS media to search, or CBFS_DEFAULT_MEDIA
+ * @name:	Name of the file
+ * @type:	Expected CBFS_TYPE_... of the file
+ * @size:	Filled out with the size of the contents
+ * @return pointer to the file contents, or NULL on error
+ */
+const void *cbfs_map_file(struct cbfs_media *media, const char *name,
+			  int type, size_t *size);
+
+/**
+ * cbfs_unmap_file() - Release contents returned by cbfs_map_file()
+ *
+ * @data:	Pointer returned by cbfs_map_file(), may be NULL
+ */
+void cbfs_unmap_file(const void *data);
+
 #endif
@@ -15,6 +15,7 @@
  * GNU General Public License for more details.
  */
 
+#include <assert.h>
 #include <libpayload.h>
 
 #include "drivers/flash/flash.h"
@@ -22,15 +23,38 @@
 void *flash_read_ops(FlashOps *ops, uint32_t offset, uint32_t size)
 {
 	die_if(!ops, "%s: No flash ops set.\n", __func__);
-	return ops->read(ops, offset, size);
+
+	if (!ops->cache || !size)
+		return ops->read(ops, offset, size);
+
+	if (ranges_contains(&ops->cache_valid, offset, offset + size)) {
+		ops->cache_hits++;
+		return ops->cache + offset;
+	}
+
+	ops->cache_misses++;
+	uint8_t *data = ops->read(ops, offset, size);
+	if (data) {
+		assert(data == ops->cache + offset);
+		ranges_add(&ops->cache_valid, offset, offset + size);
+	}
+	return data;
+}
+
+void flash_cache_invalidate_ops(FlashOps *ops, uint32_t offset, uint32_t size)
+{
+	if (ops->cache && size)
+		ranges_sub(&ops->cache_valid, offset, offset + size);
 }
 
 int flash_write_ops(FlashOps *ops, uint32_t offset, uint32_t size,
 		    const void *buffer)
 {
 	die_if(!ops, "%s: No flash ops set.\n", __func__);
-	if (ops->write)
+	if (ops->write) {
+		flash_cache_invalidate_ops(ops, offset, size);
 		return ops->write(ops, buffer, offset, size);
+	}
 
 	return 0;
 }
@@ -38,8 +62,10 @@ int flash_write_ops(FlashOps *ops, uint32_t offset, uint32_t size,
 int flash_erase_ops(FlashOps *ops, uint32_t offset, uint32_t size)
 {
 	die_if(!ops, "%s: No flash ops set.\n", __func__);
-	if (ops->erase)
+	if (ops->erase) {
+		flash_cache_invalidate_ops(ops, offset, size);
 		return ops->erase(ops, offset, size);
+	}
 
 	return 0;
 }
@@ -151,3 +177,29 @@ int flash_is_wp_enabled(void)
 {
 	return flash_is_wp_enabled_ops(flash_ops);
 }
+
+static void flash_cache_count(uint64_t start, uint64_t end, void *data)
+{
+	*(uint32_t *)data += end - start;
+}
+
+int flash_cache_stats(uint32_t *hits, uint32_t *misses, uint32_t *valid_bytes)
+{
+	die_if(!flash_ops, "%s: No flash ops set.\n", __func__);
+	if (!flash_ops->cache)
+		return -1;
+
+	*hits = flash_ops->cache_hits;
+	*misses = flash_ops->cache_misses;
+	*valid_bytes = 0;
+	ranges_for_each(&flash_ops->cache_valid, flash_cache_count,
+			valid_bytes);
+	return 0;
+}
+
+void flash_cache_invalidate(void)
+{
+	die_if(!flash_ops, "%s: No flash ops set.\n", __func__);
+	if (flash_ops->cache)
+		ranges_teardown(&flash_ops->cache_valid);
+}
@@ -20,6 +20,8 @@
 
 #include <stdint.h>
 
+#include "base/ranges.h"
+
 typedef struct FlashOps
 {
 	/* Return a pointer to the read data in the flash driver cache. */
@@ -39,6 +41,17 @@ typedef struct FlashOps
 	uint32_t sector_size;
 	/* Total number of sectors present */
 	uint32_t sector_count;
+
+	/*
+	 * Optional whole-ROM buffer that read() fills in place, so that a
+	 * successful read(offset) always returns cache + offset. When set,
+	 * flash_read_ops() remembers which ranges of it are valid and serves
+	 * repeated reads straight from it until they are written or erased.
+	 */
+	uint8_t *cache;
+	Ranges cache_valid;
+	uint32_t cache_hits;
+	uint32_t cache_misses;
 } FlashOps;
 
 /* Functions operating on flash_ops */
@@ -51,6 +64,9 @@ int flash_rewrite(uint32_t start, uint32_t length, const void *buffer);
 int flash_write_status(uint8_t status);
 int flash_read_status(void);
 int flash_is_wp_enabled(void);
+/* Returns -1 if the flash has no read cache. */
+int flash_cache_stats(uint32_t *hits, uint32_t *misses, uint32_t *valid_bytes);
+void flash_cache_invalidate(void);
 
 /* Functions operating on passed in ops */
 void *flash_read_ops(FlashOps *ops, uint32_t offset, uint32_t size);
@@ -59,6 +75,8 @@ int flash_write_ops(FlashOps *ops, uint32_t offset, uint32_t size,
 int flash_erase_ops(FlashOps *ops, uint32_t offset, uint32_t size);
 int flash_rewrite_ops(FlashOps *ops, uint32_t start, uint32_t length,
 		      const void *buffer);
+void flash_cache_invalidate_ops(FlashOps *ops, uint32_t offset,
+				uint32_t size);
 
 
 #endif /* __DRIVERS_FLASH_FLASH_H__ */
@@ -54,6 +54,7 @@ IchFlash *new_ich7_spi_flash(uint32_t rom_size)
 	Ich7SpiRegs *ich7_spi = (Ich7SpiRegs *)(rcrb + ich7_spibar_offset);
 
 	flash->ops.read = &ich_spi_flash_read;
+	flash->ops.cache = flash->cache;
 
 	flash->opmenu = ich7_spi->opmenu;
 	flash->menubytes = sizeof(ich7_spi->opmenu);
@@ -75,6 +75,7 @@ IchFlash *new_ich9_spi_flash(uint32_t rom_size)
 	Ich9SpiRegs *ich9_spi = (Ich9SpiRegs *)(rcrb + ich9_spibar_offset);
 
 	flash->ops.read = &ich_spi_flash_read;
+	flash->ops.cache = flash->cache;
 
 	flash->opmenu = ich9_spi->opmenu;
 	flash->menubytes = sizeof(ich9_spi->opmenu);
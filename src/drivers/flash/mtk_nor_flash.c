@@ -148,8 +148,10 @@ static void *mtk_nor_flash_read(FlashOps *me, uint32_t offset, uint32_t size)
 	data = flash->buffer + offset;
 
 	ret = nor_read(flash, offset, data, size);
-	if (ret)
+	if (ret) {
 		printf("nor_read fail!\n");
+		return NULL;
+	}
 
 	return data;
 }
@@ -184,5 +186,6 @@ MtkNorFlash *new_mtk_nor_flash(uintptr_t reg_addr)
 	/* Provide sufficient alignment on the cache buffer so that the
 	   underlying SPI controllers can perform optimal DMA transfers. */
 	flash->buffer = xmemalign(1*KiB, rom_size);
+	flash->ops.cache = flash->buffer;
 	return flash;
 }
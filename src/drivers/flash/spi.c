@@ -418,5 +418,6 @@ SpiFlash *new_spi_flash(SpiOps *spi)
 	/* Provide sufficient alignment on the cache buffer so that the
 	 * underlying SPI controllers can perform optimal DMA transfers. */
 	flash->cache = xmemalign(1*KiB, rom_size);
+	flash->ops.cache = flash->cache;
 	return flash;
 }
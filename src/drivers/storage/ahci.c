@@ -154,16 +154,23 @@ static int ahci_fill_sg(AhciSg *sg, void *buf, int len)
 }
 
 
-static void ahci_fill_cmd_slot(AhciIoPort *pp, uint32_t opts)
+static void *ahci_cmd_tbl(AhciIoPort *pp, int slot)
 {
-	pp->cmd_slot->opts = htolel(opts);
-	pp->cmd_slot->status = 0;
-	pp->cmd_slot->tbl_addr = htolel((uint32_t)(uintptr_t)pp->cmd_tbl);
-	pp->cmd_slot->tbl_addr_hi = 0;
+	return (uint8_t *)pp->cmd_tbl + slot * AHCI_CMD_TBL_SZ;
 }
 
+static void ahci_fill_cmd_slot(AhciIoPort *pp, int slot, uint32_t opts)
+{
+	AhciCommandHeader *cmd_slot = &pp->cmd_slot[slot];
+
+	cmd_slot->opts = htolel(opts);
+	cmd_slot->status = 0;
+	cmd_slot->tbl_addr = htolel((uint32_t)(uintptr_t)ahci_cmd_tbl(pp, slot));
+	cmd_slot->tbl_addr_hi = 0;
+}
 
-static int ahci_port_start(AhciIoPort *port, int index)
+
+static int ahci_port_start(AhciIoPort *port, int index, uint32_t n_slots)
 {
 	uint8_t *port_mmio = port->port_mmio;
 
@@ -176,19 +183,20 @@ static int ahci_port_start(AhciIoPort *port, int index)
 		return -1;
 	}
 
-	uint8_t *mem = memalign(2048, AHCI_PORT_PRIV_DMA_SZ);
+	uint8_t *mem = memalign(2048, AHCI_PORT_PRIV_DMA_SZ(n_slots));
 	if (!mem) {
 		printf("No mem for table!\n");
 		return -1;
 	}
-	memset(mem, 0, AHCI_PORT_PRIV_DMA_SZ);
+	memset(mem, 0, AHCI_PORT_PRIV_DMA_SZ(n_slots));
+	port->n_slots = n_slots;
 
 	/*
 	 * First item in chunk of DMA memory: 32-slot command table,
 	 * 32 bytes each in size
 	 */
 	port->cmd_slot = (AhciCommandHeader *)mem;
-	mem += (AHCI_CMD_SLOT_SZ + 224);
+	mem += AHCI_CMD_LIST_SZ;
 
 	/*
 	 * Second item: Received-FIS area
@@ -197,8 +205,8 @@ static int ahci_port_start(AhciIoPort *port, int index)
 	mem += AHCI_RX_FIS_SZ;
 
 	/*
-	 * Third item: data area for storing a single command
-	 * and its scatter-gather table
+	 * Third item: one command table and its scatter-gather table
+	 * for each usable command slot, slot 0 first
 	 */
 	port->cmd_tbl = mem;
 	mem += AHCI_CMD_TBL_HDR;
@@ -216,6 +224,25 @@ static int ahci_port_start(AhciIoPort *port, int index)
 	return 0;
 }
 
+/* Copy the FIS into a slot's command table and fill its command header. */
+static int ahci_prepare_cmd(AhciIoPort *port, int slot, void *fis, int fis_len,
+			    void *buf, int buf_len, int is_write)
+{
+	uint8_t *cmd_tbl = ahci_cmd_tbl(port, slot);
+
+	memcpy(cmd_tbl, fis, fis_len);
+
+	int sg_count = 0;
+	if (buf && buf_len)
+		sg_count = ahci_fill_sg((AhciSg *)(cmd_tbl + AHCI_CMD_TBL_HDR),
+					buf, buf_len);
+	if (sg_count < 0)
+		return -1;
+	uint32_t opts = (fis_len >> 2) | (sg_count << 16) | (is_write << 6);
+	ahci_fill_cmd_slot(port, slot, opts);
+
+	return 0;
+}
 
 static int ahci_device_data_io(AhciIoPort *port, void *fis, int fis_len,
 			       void *buf, int buf_len, int is_write, int wait)
@@ -229,13 +256,8 @@ static int ahci_device_data_io(AhciIoPort *port, void *fis, int fis_len,
 		return -1;
 	}
 
-	memcpy(port->cmd_tbl, fis, fis_len);
-
-	int sg_count = 0;
-	if (buf && buf_len)
-		sg_count = ahci_fill_sg(port->cmd_tbl_sg, buf, buf_len);
-	uint32_t opts = (fis_len >> 2) | (sg_count << 16) | (is_write << 6);
-	ahci_fill_cmd_slot(port, opts);
+	if (ahci_prepare_cmd(port, 0, fis, fis_len, buf, buf_len, is_write))
+		return -1;
 
 	writel_with_flush(1, port_mmio + PORT_CMD_ISSUE);
 
@@ -245,6 +267,12 @@ static int ahci_device_data_io(AhciIoPort *port, void *fis, int fis_len,
 		return -1;
 	}
 
+	if (readl(port_mmio + PORT_TFDATA) & ATA_STAT_ERR) {
+		printf("AHCI: Device error, tfd %#x.\n",
+		       readl(port_mmio + PORT_TFDATA));
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -252,8 +280,8 @@ static int ahci_device_data_io(AhciIoPort *port, void *fis, int fis_len,
  * In the general case of generic rotating media it makes sense to have a
  * flush capability. It probably even makes sense in the case of SSDs because
  * one cannot always know for sure what kind of internal cache/flush mechanism
- * is embodied therein.  Because writing to the disk in u-boot is very rare,
- * this flush command will be invoked after every block write.
+ * is embodied therein.  Because writing to the disk in firmware is very rare,
+ * this flush command will be invoked once at the end of every write request.
  */
 static int ahci_io_flush(AhciIoPort *port)
 {
@@ -275,17 +303,163 @@ static int ahci_io_flush(AhciIoPort *port)
 }
 
 /*
- * Some controllers limit number of blocks they can read/write at once.
- * Contemporary SSD devices work much faster if the read/write size is aligned
- * to a power of 2.  Let's set default to 128 and allowing to be overwritten if
- * needed.
+ * Account for finished NCQ tags that belong to asynchronous requests, and
+ * finish each request once its last tag is done.
  */
-#ifndef MAX_SATA_BLOCKS_READ_WRITE
-#define MAX_SATA_BLOCKS_READ_WRITE	0x80
-#endif
+static void ahci_ncq_retire(AhciIoPort *port, uint32_t tags, int failed)
+{
+	for (int tag = 0; tags; tag++, tags >>= 1) {
+		BlockDevRequest *req = port->ncq_req[tag];
 
-static int ahci_read_write(SataDrive *drive, lba_t start, uint16_t count,
-			   void *buf, int is_write)
+		if (!(tags & 1) || !req)
+			continue;
+
+		port->ncq_req[tag] = NULL;
+		if (failed)
+			req->status = -1;
+		if (--req->pending == 0)
+			blockdev_request_done(req);
+	}
+}
+
+/*
+ * Bring a port back after a failed NCQ command. The device aborts every
+ * outstanding queued command on error and only accepts new ones once the
+ * NCQ error log has been read.
+ */
+static void ahci_port_recover(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	static uint8_t log[512] __attribute__((aligned(2)));
+	uint8_t fis[20];
+
+	// Stop the command list DMA engine, which clears PORT_CMD_ISSUE.
+	uint32_t port_cmd = readl(port_mmio + PORT_CMD);
+	writel_with_flush(port_cmd & ~PORT_CMD_START, port_mmio + PORT_CMD);
+	if (WAIT_WHILE((readl(port_mmio + PORT_CMD) & PORT_CMD_LIST_ON), 500))
+		printf("AHCI: Port %d did not stop.\n", port->index);
+
+	// Clear error and interrupt status.
+	writel(readl(port_mmio + PORT_SCR_ERR), port_mmio + PORT_SCR_ERR);
+	writel(readl(port_mmio + PORT_IRQ_STAT), port_mmio + PORT_IRQ_STAT);
+	ahci_ncq_retire(port, port->ncq_busy, 1);
+	port->ncq_busy = 0;
+
+	writel_with_flush(port_cmd | PORT_CMD_START, port_mmio + PORT_CMD);
+
+	memset(fis, 0, 20);
+	fis[0] = 0x27;		 // Host to device FIS.
+	fis[1] = 1 << 7;	 // Command FIS.
+	fis[2] = ATA_CMD_READ_LOG_EXT;
+	fis[4] = ATA_LOG_NCQ_ERROR;
+	fis[12] = 1;		 // One 512 byte page.
+
+	if (ahci_device_data_io(port, fis, sizeof(fis), log, sizeof(log), 0,
+				wait_ms_dataio))
+		printf("AHCI: Reading NCQ error log failed.\n");
+}
+
+/*
+ * Retire NCQ tags the device has completed. The device clears a tag's bit in
+ * SActive (through a Set Device Bits FIS) once the command is done.
+ */
+static int ahci_ncq_reap(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	uint32_t done = port->ncq_busy & ~readl(port_mmio + PORT_SCR_ACT);
+
+	port->ncq_busy &= ~done;
+	ahci_ncq_retire(port, done, 0);
+
+	if (readl(port_mmio + PORT_TFDATA) & ATA_STAT_ERR) {
+		printf("AHCI: NCQ error on port %d, tfd %#x.\n", port->index,
+		       readl(port_mmio + PORT_TFDATA));
+		ahci_port_recover(port);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until at least one NCQ tag is free, or until all queued commands are
+ * done if all is set.
+ */
+static int ahci_ncq_wait(AhciIoPort *port, int all)
+{
+	uint32_t depth_mask = port->ncq_depth == 32 ? ~0U :
+			      (1U << port->ncq_depth) - 1;
+	uint64_t start = timer_us(0);
+
+	for (;;) {
+		if (ahci_ncq_reap(port))
+			return -1;
+		if (all ? !port->ncq_busy : (port->ncq_busy != depth_mask))
+			return 0;
+		if (timer_us(start) > wait_ms_dataio * 1000) {
+			printf("AHCI: NCQ timeout, busy tags %#x.\n",
+			       port->ncq_busy);
+			ahci_port_recover(port);
+			return -1;
+		}
+	}
+}
+
+static int ahci_ncq_issue(AhciIoPort *port, lba_t start, uint32_t count,
+			  void *buf, uint32_t size, int is_write,
+			  BlockDevRequest *req)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	uint8_t fis[20];
+	uint32_t tag;
+
+	if (ahci_ncq_wait(port, 0))
+		return -1;
+
+	for (tag = 0; tag < port->ncq_depth; tag++)
+		if (!(port->ncq_busy & (1U << tag)))
+			break;
+
+	// Set up the FIS.
+	memset(fis, 0, 20);
+	fis[0] = 0x27;		 // Host to device FIS.
+	fis[1] = 1 << 7;	 // Command FIS.
+	fis[2] = is_write ? ATA_CMD_WRITE_FPDMA_QUEUED :
+		ATA_CMD_READ_FPDMA_QUEUED;
+
+	// Block count goes in the features registers.
+	fis[3] = (count >> 0) & 0xff;
+	fis[11] = (count >> 8) & 0xff;
+
+	fis[4] = (start >> 0) & 0xff;
+	fis[5] = (start >> 8) & 0xff;
+	fis[6] = (start >> 16) & 0xff;
+	fis[7] = 1 << 6; /* device reg: set LBA mode */
+	// Nobody flushes after asynchronous writes, so force unit access.
+	if (req && is_write)
+		fis[7] |= 1 << 7;
+	fis[8] = (start >> 24) & 0xff;
+	fis[9] = (start >> 32) & 0xff;
+	fis[10] = (start >> 40) & 0xff;
+
+	// The tag goes in the sector count register.
+	fis[12] = tag << 3;
+
+	if (ahci_prepare_cmd(port, tag, fis, sizeof(fis), buf, size, is_write))
+		return -1;
+
+	port->ncq_busy |= 1U << tag;
+	port->ncq_req[tag] = req;
+	if (req)
+		req->pending++;
+	writel(1U << tag, port_mmio + PORT_SCR_ACT);
+	writel_with_flush(1U << tag, port_mmio + PORT_CMD_ISSUE);
+
+	return 0;
+}
+
+static int ahci_dma_io(AhciIoPort *port, lba_t start, uint32_t count,
+		       void *buf, uint32_t size, int is_write)
 {
 	uint8_t fis[20];
 
@@ -294,51 +468,95 @@ static int ahci_read_write(SataDrive *drive, lba_t start, uint16_t count,
 	fis[0] = 0x27;		 // Host to device FIS.
 	fis[1] = 1 << 7;	 // Command FIS.
 	// Command byte
-	fis[2] = is_write ? ATA_CMD_WRITE_SECTORS_EXT :
-		ATA_CMD_READ_SECTORS_EXT;
+	fis[2] = is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+
+	// LBA48 SATA command using the full 48bit address range.
+	fis[4] = (start >> 0) & 0xff;
+	fis[5] = (start >> 8) & 0xff;
+	fis[6] = (start >> 16) & 0xff;
+	fis[7] = 1 << 6; /* device reg: set LBA mode */
+	fis[8] = (start >> 24) & 0xff;
+	fis[9] = (start >> 32) & 0xff;
+	fis[10] = (start >> 40) & 0xff;
+
+	// Block count.
+	fis[12] = (count >> 0) & 0xff;
+	fis[13] = (count >> 8) & 0xff;
+
+	return ahci_device_data_io(port, fis, sizeof(fis), buf, size,
+				   is_write, wait_ms_dataio);
+}
 
-	while (count) {
-		uint16_t tblocks = MIN(MAX_SATA_BLOCKS_READ_WRITE, count);
-		uintptr_t tsize = tblocks * drive->dev.block_size;
+/*
+ * Some controllers limit number of blocks they can read/write at once.
+ * Contemporary SSD devices work much faster if the read/write size is aligned
+ * to a power of 2.  Let's set default to 128 and allowing to be overwritten if
+ * needed.
+ */
+#ifndef MAX_SATA_BLOCKS_READ_WRITE
+#define MAX_SATA_BLOCKS_READ_WRITE	0x80
+#endif
 
-		// LBA48 SATA command using 32bit address range.
-		fis[3] = 0xe0; /* features */
-		fis[4] = (start >> 0) & 0xff;
-		fis[5] = (start >> 8) & 0xff;
-		fis[6] = (start >> 16) & 0xff;
-		fis[7] = 1 << 6; /* device reg: set LBA mode */
-		fis[8] = ((start >> 24) & 0xff);
+/*
+ * With NCQ, up to ncq_depth chunks are kept in flight and the device may
+ * complete them in any order; otherwise each chunk is a synchronous DMA
+ * command.
+ */
+static int ahci_read_write(SataDrive *drive, lba_t start, lba_t count,
+			   void *buf, int is_write)
+{
+	AhciIoPort *port = drive->port;
+	int ret;
 
-		// Block count.
-		fis[12] = (tblocks >> 0) & 0xff;
-		fis[13] = (tblocks >> 8) & 0xff;
+	while (count) {
+		uint32_t tblocks = MIN(MAX_SATA_BLOCKS_READ_WRITE, count);
+		uint32_t tsize = tblocks * drive->dev.block_size;
 
 		// Read/write from AHCI.
-		if (ahci_device_data_io(drive->port, fis, sizeof(fis), buf,
-					tsize, is_write, wait_ms_dataio)) {
+		if (port->ncq_depth)
+			ret = ahci_ncq_issue(port, start, tblocks, buf, tsize,
+					     is_write, NULL);
+		else
+			ret = ahci_dma_io(port, start, tblocks, buf, tsize,
+					  is_write);
+		if (ret) {
 			printf("AHCI: %s command failed.\n",
 			      is_write ? "write" : "read");
 			return -1;
 		}
 
-		// Flush writes.
-		if (is_write) {
-			if (ahci_io_flush(drive->port) < 0)
-				return -1;
-		}
-
 		buf = (uint8_t *)buf + tsize;
 		count -= tblocks;
 		start += tblocks;
 	}
 
+	if (port->ncq_depth && ahci_ncq_wait(port, 1)) {
+		printf("AHCI: %s command failed.\n",
+		      is_write ? "write" : "read");
+		return -1;
+	}
+
 	return 0;
 }
 
+static int ahci_read_write_retry(SataDrive *drive, lba_t start, lba_t count,
+				 void *buf, int is_write)
+{
+	if (!ahci_read_write(drive, start, count, buf, is_write))
+		return 0;
+
+	if (!drive->port->ncq_depth)
+		return -1;
+
+	printf("AHCI: Retrying without NCQ.\n");
+	drive->port->ncq_depth = 0;
+	return ahci_read_write(drive, start, count, buf, is_write);
+}
+
 static lba_t ahci_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
 {
 	SataDrive *drive = container_of(me, SataDrive, dev.ops);
-	if (ahci_read_write(drive, start, count, buffer, 0)) {
+	if (ahci_read_write_retry(drive, start, count, buffer, 0)) {
 		printf("AHCI: Read failed.\n");
 		return -1;
 	}
@@ -349,13 +567,83 @@ static lba_t ahci_write(BlockDevOps *me, lba_t start, lba_t count,
 			const void *buffer)
 {
 	SataDrive *drive = container_of(me, SataDrive, dev.ops);
-	if (ahci_read_write(drive, start, count, (void *)buffer, 1)) {
+	if (ahci_read_write_retry(drive, start, count, (void *)buffer, 1) ||
+	    ahci_io_flush(drive->port) < 0) {
 		printf("AHCI: Write failed.\n");
 		return -1;
 	}
 	return count;
 }
 
+/*
+ * Queue an asynchronous request as NCQ commands without waiting for them.
+ * Ports that have fallen back to non-queued commands run it synchronously.
+ * The extra reference held while queueing keeps reaps done to free up tags
+ * from finishing the request early.
+ */
+static int ahci_submit(BlockDevOps *me, BlockDevRequest *req)
+{
+	SataDrive *drive = container_of(me, SataDrive, dev.ops);
+	AhciIoPort *port = drive->port;
+	uint8_t *buf = req->buffer;
+	lba_t start = req->start;
+	lba_t count = req->count;
+	int queued = 0;
+
+	if (!port->ncq_depth) {
+		lba_t ret = req->is_write ?
+			ahci_write(me, start, count, buf) :
+			ahci_read(me, start, count, buf);
+		if (ret != count)
+			req->status = -1;
+		blockdev_request_done(req);
+		return 0;
+	}
+
+	req->pending++;
+	while (count) {
+		uint32_t tblocks = MIN(MAX_SATA_BLOCKS_READ_WRITE, count);
+		uint32_t tsize = tblocks * drive->dev.block_size;
+
+		if (ahci_ncq_issue(port, start, tblocks, buf, tsize,
+				   req->is_write, req)) {
+			printf("AHCI: Queueing %s failed.\n",
+			       req->is_write ? "write" : "read");
+			req->status = -1;
+			break;
+		}
+		queued = 1;
+		buf += tsize;
+		count -= tblocks;
+		start += tblocks;
+	}
+	req->pending--;
+
+	if (!queued)
+		return -1;
+	if (!req->pending)
+		blockdev_request_done(req);
+	return 0;
+}
+
+static void ahci_poll(BlockDevOps *me, int wait)
+{
+	SataDrive *drive = container_of(me, SataDrive, dev.ops);
+	AhciIoPort *port = drive->port;
+	uint32_t busy = port->ncq_busy;
+	uint64_t start = timer_us(0);
+
+	do {
+		if (ahci_ncq_reap(port) || port->ncq_busy != busy)
+			return;
+		if (timer_us(start) > wait_ms_dataio * 1000) {
+			printf("AHCI: NCQ timeout, busy tags %#x.\n", busy);
+			ahci_port_recover(port);
+			return;
+		}
+	} while (wait && busy);
+}
+
 static inline int ata_implements_major(AtaIdentify *id, AtaMajorRevision rev)
 {
 	uint16_t major = le16toh(id->major_version);
@@ -415,19 +703,17 @@ static int ahci_identify(AhciIoPort *port, AtaIdentify *id)
 	return ret;
 }
 
-static int ahci_read_capacity(AhciIoPort *port, lba_t *cap,
+static int ahci_read_capacity(AhciIoPort *port, AtaIdentify *id, lba_t *cap,
 			      unsigned *block_size)
 {
-	AtaIdentify id;
-
-	if (ahci_identify(port, &id))
+	if (ahci_identify(port, id))
 		return -1;
 
 	uint32_t cap32;
-	memcpy(&cap32, &id.sectors28, sizeof(cap32));
+	memcpy(&cap32, &id->sectors28, sizeof(cap32));
 	*cap = letohl(cap32);
 	if (*cap == 0xfffffff) {
-		memcpy(cap, id.sectors48, sizeof(*cap));
+		memcpy(cap, id->sectors48, sizeof(*cap));
 		*cap = letohll(*cap);
 	}
 
@@ -435,6 +721,20 @@ static int ahci_read_capacity(AhciIoPort *port, lba_t *cap,
 	return 0;
 }
 
+static void ahci_setup_ncq(AhciCtrlr *ctrlr, AhciIoPort *port, AtaIdentify *id)
+{
+	port->ncq_depth = 0;
+	port->ncq_busy = 0;
+
+	if (!(ctrlr->cap & HOST_CAP_NCQ) ||
+	    !(le16toh(id->word76_79[0]) & ATA_SATA_CAP_NCQ))
+		return;
+
+	port->ncq_depth = MIN(port->n_slots,
+			      ATA_QUEUE_DEPTH(le16toh(id->queue_depth)));
+	printf("Port %d NCQ depth %d.\n", port->index, port->ncq_depth);
+}
+
 static int ahci_exit(struct CleanupFunc *cleanup, CleanupType type)
 {
 	AhciCtrlr *ctrlr = cleanup->data;
@@ -640,16 +940,21 @@ static int ahci_ctrlr_init(BlockDevCtrlrOps *me)
 	for (int i = 0; i < sizeof(linkmap) * 8; i++) {
 		if (((linkmap >> i) & 0x1)) {
 			AhciIoPort *port = &ctrlr->ports[i];
-			if (ahci_port_start(port, i)) {
+			uint32_t n_slots = 1;
+			if (ctrlr->cap & HOST_CAP_NCQ)
+				n_slots = HOST_CAP_NCS(ctrlr->cap);
+			if (ahci_port_start(port, i, n_slots)) {
 				printf("Can not start port %d\n", i);
 				continue;
 			}
+			AtaIdentify id;
 			lba_t cap;
 			unsigned block_size;
-			if (ahci_read_capacity(port, &cap, &block_size)) {
+			if (ahci_read_capacity(port, &id, &cap, &block_size)) {
 				printf("Can't read port %d's capacity.\n", i);
 				continue;
 			}
+			ahci_setup_ncq(ctrlr, port, &id);
 
 			SataDrive *sata_drive = xzalloc(sizeof(*sata_drive));
 			static const int name_size = 18;
@@ -658,6 +963,10 @@ static int ahci_ctrlr_init(BlockDevCtrlrOps *me)
 			sata_drive->dev.ops.read = &ahci_read;
 			sata_drive->dev.ops.write = &ahci_write;
 			sata_drive->dev.ops.new_stream = &new_simple_stream;
+			if (port->ncq_depth) {
+				sata_drive->dev.ops.submit = &ahci_submit;
+				sata_drive->dev.ops.poll = &ahci_poll;
+			}
 			sata_drive->dev.name = name;
 			sata_drive->dev.removable = 0;
 			sata_drive->dev.block_size = block_size;
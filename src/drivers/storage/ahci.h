@@ -31,9 +31,11 @@
 #define AHCI_RX_FIS_SZ		256
 #define AHCI_CMD_TBL_HDR	0x80
 #define AHCI_CMD_TBL_CDB	0x40
-#define AHCI_CMD_TBL_SZ		AHCI_CMD_TBL_HDR + (AHCI_MAX_SG * 16)
-#define AHCI_PORT_PRIV_DMA_SZ	AHCI_CMD_SLOT_SZ + AHCI_CMD_TBL_SZ	\
-				+ AHCI_RX_FIS_SZ
+#define AHCI_CMD_TBL_SZ		(AHCI_CMD_TBL_HDR + (AHCI_MAX_SG * 16))
+#define AHCI_MAX_CMD_SLOTS	32
+#define AHCI_CMD_LIST_SZ	(AHCI_MAX_CMD_SLOTS * AHCI_CMD_SLOT_SZ)
+#define AHCI_PORT_PRIV_DMA_SZ(slots)	(AHCI_CMD_LIST_SZ + AHCI_RX_FIS_SZ \
+					 + (slots) * AHCI_CMD_TBL_SZ)
 #define AHCI_CMD_ATAPI		(1 << 5)
 #define AHCI_CMD_WRITE		(1 << 6)
 #define AHCI_CMD_PREFETCH	(1 << 7)
@@ -42,6 +44,10 @@
 
 #define RX_FIS_D2H_REG		0x40	/* offset of D2H Register FIS data */
 
+/* HOST_CAP bits */
+#define HOST_CAP_NCQ		(1 << 30) /* native command queuing */
+#define HOST_CAP_NCS(cap)	((((cap) >> 8) & 0x1f) + 1) /* cmd slots */
+
 /* Global controller registers */
 #define HOST_CAP		0x00 /* host capabilities */
 #define HOST_CTL		0x04 /* global host control */
@@ -171,6 +177,12 @@ typedef struct AhciIoPort {
 	void *cmd_tbl;
 	void *rx_fis;
 	int index;
+
+	uint32_t n_slots;	// command slots with a command table
+	uint32_t ncq_depth;	// NCQ tags usable, 0 if NCQ is not used
+	uint32_t ncq_busy;	// NCQ tags issued but not yet completed
+	// Asynchronous request each NCQ tag belongs to, if any.
+	BlockDevRequest *ncq_req[AHCI_MAX_CMD_SLOTS];
 } AhciIoPort;
 
 typedef struct AhciCtrlr {
@@ -53,6 +53,8 @@ typedef enum AtaCommand {
 	ATA_CMD_TRUSTED_RECEIVE_DMA = 0x5d,
 	ATA_CMD_TRUSTED_SEND = 0x5e,
 	ATA_CMD_TRUSTED_SEND_DMA = 0x5f,
+	ATA_CMD_READ_FPDMA_QUEUED = 0x60,
+	ATA_CMD_WRITE_FPDMA_QUEUED = 0x61,
 	ATA_CMD_CFA_TRANSLATE_SECTOR = 0x87,
 	ATA_CMD_EXECUTE_DEVICE_DIAGNOSTIC = 0x90,
 	ATA_CMD_DOWNLOAD_MICROCODE = 0x92,
@@ -108,6 +110,14 @@ typedef enum AtaStatus {
 
 #include <stdint.h>
 
+/* Serial ATA capabilities (IDENTIFY word 76) */
+#define ATA_SATA_CAP_NCQ	(1 << 8)
+/* Maximum queue depth - 1 (IDENTIFY word 75) */
+#define ATA_QUEUE_DEPTH(x)	(((x) & 0x1f) + 1)
+
+/* Log page holding the NCQ command error status */
+#define ATA_LOG_NCQ_ERROR	0x10
+
 typedef enum AtaMajorRevision {
 	ATA_MAJOR_ATA4	= (1 << 4),
 	ATA_MAJOR_ATA5	= (1 << 5),
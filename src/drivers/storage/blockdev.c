@@ -21,52 +21,196 @@
 #include <libpayload.h>
 #include <stdio.h>
 
+#include "base/profile.h"
+#include "drivers/storage/bouncebuf.h"
+
 ListNode fixed_block_devices;
 ListNode removable_block_devices;
 
 ListNode fixed_block_dev_controllers;
 ListNode removable_block_dev_controllers;
 
+/*
+ * Reads smaller than this are served from a read-ahead buffer of the same
+ * size, so that runs of small header reads turn into one large transfer.
+ * Larger reads go straight into the caller's buffer. On devices that can
+ * queue requests, the next buffer is fetched while the current one is used.
+ */
+#define STREAM_READAHEAD_BYTES	(256 * KiB)
+
 typedef struct {
 	StreamOps stream;
 	BlockDev *blockdev;
+	/* Next sector to fetch from the device. */
 	lba_t current_sector;
 	lba_t end_sector;
+
+	/* Read-ahead buffer, allocated on the first small read. */
+	uint8_t *buffer;
+	lba_t buffer_sectors;
+	/* Bytes of the buffer already consumed, and bytes valid in it. */
+	size_t buffer_offset;
+	size_t buffer_len;
+
+	/* Asynchronous read-ahead into the second buffer. */
+	uint8_t *prefetch_buffer;
+	BlockDevRequest prefetch;
+	int prefetching;
 } SimpleStream;
 
+static int simple_stream_fetch(SimpleStream *stream, lba_t sectors,
+			       void *buffer)
+{
+	lba_t ret = stream->blockdev->ops.read(&stream->blockdev->ops,
+					       stream->current_sector, sectors,
+					       buffer);
+	if (ret != sectors) {
+		printf("read_stream_simple failed at sector %lld, "
+		       "read %lld of %lld sectors\n",
+		       stream->current_sector, ret, sectors);
+		return -1;
+	}
+
+	stream->current_sector += sectors;
+	return 0;
+}
+
+static void simple_stream_prefetch_done(BlockDevRequest *req)
+{
+	SimpleStream *stream = req->data;
+	stream->prefetching = 0;
+}
+
+/* Start fetching the next buffer if the device can do it in the background. */
+static void simple_stream_prefetch(SimpleStream *stream)
+{
+	BlockDevOps *ops = &stream->blockdev->ops;
+	BlockDevRequest *req = &stream->prefetch;
+	lba_t left = stream->end_sector - stream->current_sector;
+
+	if (!ops->submit || !left || stream->prefetching)
+		return;
+
+	if (!stream->prefetch_buffer)
+		stream->prefetch_buffer = xmemalign(ARCH_DMA_MINALIGN,
+			stream->buffer_sectors * stream->blockdev->block_size);
+
+	req->is_write = 0;
+	req->start = stream->current_sector;
+	req->count = MIN(stream->buffer_sectors, left);
+	req->buffer = stream->prefetch_buffer;
+	req->complete = simple_stream_prefetch_done;
+	req->data = stream;
+
+	/* If it can't be queued, the next refill just reads synchronously. */
+	if (blockdev_submit(ops, req))
+		return;
+
+	stream->prefetching = 1;
+	stream->current_sector += req->count;
+}
+
+/* Wait for the read-ahead and make it the current buffer. */
+static int simple_stream_take_prefetch(SimpleStream *stream)
+{
+	uint8_t *buffer = stream->buffer;
+
+	while (stream->prefetching)
+		blockdev_poll(&stream->blockdev->ops, 1);
+
+	if (stream->prefetch.status) {
+		printf("read_stream_simple read-ahead failed at sector %lld\n",
+		       stream->prefetch.start);
+		return -1;
+	}
+
+	stream->buffer = stream->prefetch_buffer;
+	stream->prefetch_buffer = buffer;
+	stream->buffer_offset = 0;
+	stream->buffer_len = stream->prefetch.count *
+			     stream->blockdev->block_size;
+	return 0;
+}
+
 uint64_t simple_stream_read(StreamOps *me, uint64_t count, void *buffer)
 {
 	SimpleStream *stream = container_of(me, SimpleStream, stream);
 	unsigned block_size = stream->blockdev->block_size;
+	uint8_t *dest = buffer;
+	uint64_t done = 0;
 
-	/* TODO(dehrenberg): implement buffering so that unaligned reads are
-	 * possible because alignment constraints are obscure */
-	if (count & (block_size - 1)) {
-		printf("read_stream_simple(%lld) not LBA multiple\n", count);
-		return 0;
-	}
+	while (done < count) {
+		uint64_t todo = count - done;
 
-	uint64_t sectors = count / block_size;
-	if (sectors > stream->end_sector - stream->current_sector) {
-		printf("read_stream_simple past the end, "
-		       "end_sector=%lld, current_sector=%lld, sectors=%lld\n",
-		       stream->end_sector, stream->current_sector, sectors);
-		return 0;
-	}
+		/* Drain whatever is left over from the last read-ahead. */
+		if (stream->buffer_offset < stream->buffer_len) {
+			size_t chunk = MIN(todo, stream->buffer_len -
+						 stream->buffer_offset);
+			memcpy(dest + done,
+			       stream->buffer + stream->buffer_offset, chunk);
+			stream->buffer_offset += chunk;
+			done += chunk;
+			continue;
+		}
 
-	int ret = stream->blockdev->ops.read(&stream->blockdev->ops,
-					     stream->current_sector, sectors,
-					     buffer);
-	if (ret != sectors)
-		return ret;
+		/* Then whatever was fetched in the background. */
+		if (stream->prefetching) {
+			if (simple_stream_take_prefetch(stream))
+				break;
+			/*
+			 * Whatever this buffer doesn't cover of a large read
+			 * goes straight to the device below, so only read
+			 * ahead again for small reads.
+			 */
+			if (todo < stream->buffer_len + STREAM_READAHEAD_BYTES)
+				simple_stream_prefetch(stream);
+			continue;
+		}
 
-	stream->current_sector += sectors;
-	return count;
+		lba_t left = stream->end_sector - stream->current_sector;
+		if (!left) {
+			printf("read_stream_simple past the end, "
+			       "end_sector=%lld, wanted %lld more bytes\n",
+			       stream->end_sector, todo);
+			break;
+		}
+
+		/* Large reads bypass the buffer, except for a partial tail. */
+		if (todo >= STREAM_READAHEAD_BYTES) {
+			lba_t sectors = MIN(todo / block_size, left);
+
+			if (simple_stream_fetch(stream, sectors, dest + done))
+				break;
+			done += sectors * block_size;
+			continue;
+		}
+
+		if (!stream->buffer) {
+			stream->buffer_sectors =
+				STREAM_READAHEAD_BYTES / block_size;
+			stream->buffer = xmemalign(ARCH_DMA_MINALIGN,
+				stream->buffer_sectors * block_size);
+		}
+
+		lba_t sectors = MIN(stream->buffer_sectors, left);
+		if (simple_stream_fetch(stream, sectors, stream->buffer))
+			break;
+		stream->buffer_offset = 0;
+		stream->buffer_len = sectors * block_size;
+		simple_stream_prefetch(stream);
+	}
+
+	return done;
 }
 
 static void simple_stream_close(StreamOps *me)
 {
 	SimpleStream *stream = container_of(me, SimpleStream, stream);
+
+	while (stream->prefetching)
+		blockdev_poll(&stream->blockdev->ops, 1);
+	free(stream->prefetch_buffer);
+	free(stream->buffer);
 	free(stream);
 }
 
@@ -81,9 +225,93 @@ StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count)
 	stream->stream.close = simple_stream_close;
 	/* Check that block size is a power of 2 */
 	assert((blockdev->block_size & (blockdev->block_size - 1)) == 0);
+	assert(blockdev->block_size <= STREAM_READAHEAD_BYTES);
 	return &stream->stream;
 }
 
+int blockdev_submit(BlockDevOps *me, BlockDevRequest *req)
+{
+	BlockDev *dev = (BlockDev *)me;
+	lba_t ret;
+
+	req->dev = dev;
+	req->status = 0;
+	req->pending = 0;
+
+	if (me->submit) {
+		if (me->submit(me, req))
+			return -1;
+		dev->requests_inflight++;
+		return 0;
+	}
+
+	if (req->is_write)
+		ret = me->write(me, req->start, req->count, req->buffer);
+	else
+		ret = me->read(me, req->start, req->count, req->buffer);
+	if (ret != req->count)
+		req->status = -1;
+
+	dev->requests_inflight++;
+	blockdev_request_done(req);
+	return 0;
+}
+
+void blockdev_request_done(BlockDevRequest *req)
+{
+	list_insert_after(&req->list_node, &req->dev->requests_done);
+}
+
+int blockdev_poll(BlockDevOps *me, int wait)
+{
+	BlockDev *dev = (BlockDev *)me;
+
+	if (me->poll && dev->requests_inflight)
+		me->poll(me, wait && !dev->requests_done.next);
+
+	while (dev->requests_done.next) {
+		BlockDevRequest *req = container_of(dev->requests_done.next,
+						    BlockDevRequest, list_node);
+		list_remove(&req->list_node);
+		dev->requests_inflight--;
+		if (req->complete)
+			req->complete(req);
+	}
+
+	return dev->requests_inflight;
+}
+
+void blockdev_drain(BlockDevOps *me)
+{
+	while (blockdev_poll(me, 1))
+		;
+}
+
+/*
+ * Update the controllers on a list which need it. Controllers which can't
+ * tell cheaply whether their media changed are only updated if force is set.
+ */
+static void update_ctrlrs(ListNode *ctrlrs, int force)
+{
+	BlockDevCtrlr *ctrlr;
+	list_for_each(ctrlr, *ctrlrs, list_node) {
+		if (!ctrlr->ops.update || !ctrlr->need_update)
+			continue;
+
+		if (ctrlr->ops.media_changed) {
+			if (!ctrlr->ops.media_changed(&ctrlr->ops))
+				continue;
+		} else if (!force) {
+			continue;
+		}
+
+		int span = profile_begin("storage update", ctrlr->ops.update);
+		if (ctrlr->ops.update(&ctrlr->ops))
+			printf("Updating storage controller failed.\n");
+		profile_end(span);
+	}
+}
+
 int get_all_bdevs(blockdev_type_t type, ListNode **bdevs)
 {
 	ListNode *ctrlrs, *devs;
@@ -98,12 +326,7 @@ int get_all_bdevs(blockdev_type_t type, ListNode **bdevs)
 	}
 
 	/* Update any controllers that need it. */
-	BlockDevCtrlr *ctrlr;
-	list_for_each(ctrlr, *ctrlrs, list_node) {
-		if (ctrlr->ops.update && ctrlr->need_update &&
-		    ctrlr->ops.update(&ctrlr->ops))
-			printf("Updating storage controller failed.\n");
-	}
+	update_ctrlrs(ctrlrs, 1);
 
 	/* Count the devices. */
 	for (ListNode *node = devs->next; node; node = node->next, count++)
@@ -113,3 +336,18 @@ int get_all_bdevs(blockdev_type_t type, ListNode **bdevs)
 		*bdevs = devs;
 	return count;
 }
+
+void blockdev_hotplug_poll(void)
+{
+	static uint64_t last_poll;
+	static int polled;
+	int force = 0;
+
+	if (!polled || timer_us(last_poll) >= BLOCKDEV_HOTPLUG_POLL_US) {
+		last_poll = timer_us(0);
+		polled = 1;
+		force = 1;
+	}
+
+	update_ctrlrs(&removable_block_dev_controllers, force);
+}
@@ -25,6 +25,30 @@
 
 typedef uint64_t lba_t;
 
+struct BlockDev;
+
+/*
+ * An asynchronous read or write, see blockdev_submit(). The request must
+ * stay allocated, and its buffer untouched, until complete() has been called.
+ */
+typedef struct BlockDevRequest {
+	int is_write;
+	lba_t start;
+	lba_t count;
+	void *buffer;
+	/* Called from blockdev_poll() once the request has finished. */
+	void (*complete)(struct BlockDevRequest *req);
+	void *data;
+
+	/* 0 on success, -1 if any part of the request failed. */
+	int status;
+
+	/* Private to the block device layer while the request is in flight. */
+	struct BlockDev *dev;
+	uint32_t pending;
+	ListNode list_node;
+} BlockDevRequest;
+
 typedef struct BlockDevOps {
 	lba_t (*read)(struct BlockDevOps *me, lba_t start, lba_t count,
 		      void *buffer);
@@ -35,6 +59,17 @@ typedef struct BlockDevOps {
 	lba_t (*erase)(struct BlockDevOps *me, lba_t start, lba_t count);
 	StreamOps *(*new_stream)(struct BlockDevOps *me, lba_t start,
 				 lba_t count);
+	/*
+	 * Optional asynchronous interface, only to be used through
+	 * blockdev_submit() and blockdev_poll(). submit() starts the request
+	 * and returns 0, or -1 if nothing could be started. Devices hand
+	 * finished requests back with blockdev_request_done(), from either
+	 * call. poll() reaps finished commands, waiting for at least one to
+	 * finish if wait is set and any are outstanding. Requests that time
+	 * out must be finished with a failed status, never dropped.
+	 */
+	int (*submit)(struct BlockDevOps *me, BlockDevRequest *req);
+	void (*poll)(struct BlockDevOps *me, int wait);
 } BlockDevOps;
 
 typedef struct BlockDev {
@@ -49,6 +84,10 @@ typedef struct BlockDev {
 	lba_t block_count;		/* size addressable by read/write */
 	lba_t stream_block_count;	/* size addressible by new_stream */
 
+	/* Asynchronous requests submitted, and finished ones not yet polled */
+	int requests_inflight;
+	ListNode requests_done;
+
 	ListNode list_node;
 } BlockDev;
 
@@ -62,6 +101,13 @@ typedef struct BlockDevCtrlrOps {
 	 * failure
 	 */
 	int (*is_bdev_owned)(struct BlockDevCtrlrOps *me, BlockDev *bdev);
+	/*
+	 * Optional, cheap check (card detect register or GPIO) of whether
+	 * update() would have anything to do. Returns 1 if the media may
+	 * have changed, 0 if not. Controllers without it are updated every
+	 * time they're asked to be, or rate limited by blockdev_hotplug_poll().
+	 */
+	int (*media_changed)(struct BlockDevCtrlrOps *me);
 } BlockDevCtrlrOps;
 
 typedef struct BlockDevCtrlr {
@@ -76,6 +122,23 @@ extern ListNode removable_block_dev_controllers;
 
 StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count);
 
+/*
+ * Start an asynchronous request. Devices without a submit() op run the
+ * request synchronously. Either way the completion callback only runs from
+ * blockdev_poll(). Returns 0 if the request was started, -1 otherwise.
+ */
+int blockdev_submit(BlockDevOps *me, BlockDevRequest *req);
+/*
+ * Run the completion callbacks of finished requests, in no particular order.
+ * If wait is set and none have finished yet, wait for at least one. Returns
+ * the number of requests still in flight.
+ */
+int blockdev_poll(BlockDevOps *me, int wait);
+/* Wait for all outstanding requests and run their completion callbacks. */
+void blockdev_drain(BlockDevOps *me);
+/* Called by block devices when all parts of a request are finished. */
+void blockdev_request_done(BlockDevRequest *req);
+
 typedef enum {
 	BLOCKDEV_FIXED,
 	BLOCKDEV_REMOVABLE,
@@ -83,4 +146,12 @@ typedef enum {
 
 int get_all_bdevs(blockdev_type_t type, ListNode **bdevs);
 
+/*
+ * Look for removable media being inserted or removed. Meant to be called
+ * from UI loops: controllers with a media_changed() op are checked every
+ * time, others at most every BLOCKDEV_HOTPLUG_POLL_US.
+ */
+#define BLOCKDEV_HOTPLUG_POLL_US	(250 * 1000)
+void blockdev_hotplug_poll(void);
+
 #endif /* __DRIVERS_STORAGE_BLOCKDEV_H__ */
@@ -348,6 +348,24 @@ static int dwmci_init(BlockDevCtrlrOps *me)
 	return 0;
 }
 
+static int dwmci_card_present(DwmciHost *host)
+{
+	if (host->cd_gpio)	//use gpio detect
+		return gpio_get(host->cd_gpio);
+	else
+		return !dwmci_readl(host, DWMCI_CDETECT);
+}
+
+static int dwmci_media_changed(BlockDevCtrlrOps *me)
+{
+	DwmciHost *host = container_of(me, DwmciHost, mmc.ctrlr.ops);
+
+	if (!host->initialized || !host->removable)
+		return 1;
+
+	return dwmci_card_present(host) != (host->mmc.media != NULL);
+}
+
 static int dwmci_update(BlockDevCtrlrOps *me)
 {
 	DwmciHost *host = container_of(me, DwmciHost, mmc.ctrlr.ops);
@@ -358,12 +376,8 @@ static int dwmci_update(BlockDevCtrlrOps *me)
 	host->initialized = 1;
 
 	if (host->removable) {
-		int present = 0;
+		int present = dwmci_card_present(host);
 
-		if (host->cd_gpio)	//use gpio detect
-			present = gpio_get(host->cd_gpio);
-		else
-			present = !dwmci_readl(host, DWMCI_CDETECT);
 		if (present && !host->mmc.media) {
 			// A card is present and not set up yet. Get it ready.
 			if (mmc_setup_media(&host->mmc))
@@ -411,6 +425,7 @@ DwmciHost *new_dwmci_host(uintptr_t ioaddr, uint32_t src_hz,
 	DwmciHost *ctrlr = xzalloc(sizeof(*ctrlr));
 
 	ctrlr->mmc.ctrlr.ops.update = &dwmci_update;
+	ctrlr->mmc.ctrlr.ops.media_changed = &dwmci_media_changed;
 	ctrlr->mmc.ctrlr.ops.is_bdev_owned = block_mmc_is_bdev_owned;
 
 	ctrlr->mmc.ctrlr.need_update = 1;
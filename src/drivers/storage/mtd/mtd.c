@@ -0,0 +1,53 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include "drivers/storage/mtd/mtd.h"
+
+enum {
+	MtdBlockUnknown = 0,
+	MtdBlockGood,
+	MtdBlockBad,
+};
+
+static uint8_t *mtd_bbt_entry(MtdDev *mtd, uint64_t ofs)
+{
+	if (ofs >= mtd->size || ofs % mtd->erasesize)
+		return NULL;
+
+	if (!mtd->bbt)
+		mtd->bbt = xzalloc(mtd->size / mtd->erasesize);
+
+	return &mtd->bbt[ofs / mtd->erasesize];
+}
+
+int mtd_block_isbad(MtdDev *mtd, uint64_t ofs)
+{
+	uint8_t *entry = mtd_bbt_entry(mtd, ofs);
+	int ret;
+
+	if (!entry)
+		return -EINVAL;
+
+	if (*entry != MtdBlockUnknown)
+		return *entry == MtdBlockBad;
+
+	ret = mtd->block_isbad(mtd, ofs);
+	// Errors aren't remembered, the next caller gets to try again.
+	if (ret >= 0)
+		*entry = ret ? MtdBlockBad : MtdBlockGood;
+	return ret;
+}
@@ -161,6 +161,9 @@ typedef struct MtdDev {
 	/* ECC status information */
 	struct mtd_ecc_stats ecc_stats;
 
+	/* RAM bad block table, see mtd_block_isbad(). */
+	uint8_t *bbt;
+
 	void *priv;
 } MtdDev;
 
@@ -169,4 +172,12 @@ typedef struct MtdDevCtrlr {
 	int (*update)(struct MtdDevCtrlr *me);
 } MtdDevCtrlr;
 
+/*
+ * Like mtd->block_isbad(), but remembering the answer for each erase block in
+ * a table kept with the MtdDev, so the OOB of a block is only read the first
+ * time anybody asks about it. Nothing here marks blocks bad, so the answers
+ * can't go stale.
+ */
+int mtd_block_isbad(MtdDev *mtd, uint64_t ofs);
+
 #endif /* __DRIVERS_STORAGE_MTD_MTD_H__ */
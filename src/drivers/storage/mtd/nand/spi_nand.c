@@ -580,6 +580,19 @@ static int spi_nand_read_oob(MtdDev *mtd, uint64_t from,
 	corrected = mtd->ecc_stats.corrected;
 
 	for (i = start; i < (start + pages); i++) {
+		/*
+		 * Whole pages of data without OOB go straight into the user
+		 * buffer, which saves copying every page of a large read.
+		 */
+		if (!ops->oobbuf && ops->len - ops->retlen >= mtd->writesize) {
+			ret = spi_nand_read_page(mtd, i, 0, mtd->writesize,
+						 ops->datbuf + ops->retlen,
+						 (ops->mode == MTD_OOB_RAW));
+			if (ret < 0)
+				goto done;
+			ops->retlen += mtd->writesize;
+			continue;
+		}
 
 		spi_nand_debug_poison_buf(read_buf, read_len);
 
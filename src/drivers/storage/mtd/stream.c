@@ -24,6 +24,9 @@ typedef struct {
 	MtdDev *mtd;
 	uint64_t offset;
 	uint64_t limit;
+	/* The last page read for an unaligned access, and where it's from. */
+	uint8_t *page_buf;
+	uint64_t page_buf_offset;
 } MtdStream;
 
 typedef struct {
@@ -33,6 +36,56 @@ typedef struct {
 
 #define stream_debug(...) do { if (0) printf(__VA_ARGS__); } while (0)
 
+/* Read length bytes at the stream's offset, within a single erase block. */
+static int read_mtd_chunk(MtdStream *mtd_stream, uint64_t length,
+			  void *buffer)
+{
+	MtdDev *mtd = mtd_stream->mtd;
+	size_t retlen;
+
+	int ret = mtd->read(mtd, mtd_stream->offset, length, &retlen, buffer);
+	if (ret < 0 && ret != -EUCLEAN) {
+		printf("Read failure!! ret=%d\n", ret);
+		return ret;
+	}
+	if (retlen != length) {
+		printf("Read failure!! retlen=%zd\n", retlen);
+		return -EIO;
+	}
+	return 0;
+}
+
+/*
+ * Copy out of the page the stream's offset is in, reading that page into the
+ * stream's page buffer first if it isn't there already.
+ */
+static int read_mtd_partial_page(MtdStream *mtd_stream, uint64_t length,
+				 void *buffer)
+{
+	MtdDev *mtd = mtd_stream->mtd;
+	uint64_t page_offset = mtd_stream->offset % mtd->writesize;
+	uint64_t page = mtd_stream->offset - page_offset;
+
+	if (!mtd_stream->page_buf)
+		mtd_stream->page_buf = xmalloc(mtd->writesize);
+
+	if (mtd_stream->page_buf_offset != page) {
+		uint64_t offset = mtd_stream->offset;
+		int ret;
+
+		mtd_stream->offset = page;
+		ret = read_mtd_chunk(mtd_stream, mtd->writesize,
+				     mtd_stream->page_buf);
+		mtd_stream->offset = offset;
+		if (ret)
+			return ret;
+		mtd_stream->page_buf_offset = page;
+	}
+
+	memcpy(buffer, mtd_stream->page_buf + page_offset, length);
+	return 0;
+}
+
 /* returns amount written on success */
 static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 				void *buffer) {
@@ -44,15 +97,6 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 	MtdDev *mtd = mtd_stream->mtd;
 	assert(mtd != NULL);
 
-	/* TODO(dehrenberg): before any release is made:
-	 * Implement unaligned reads in a generic way, in a buffer managed by
-	 * the general MTD layer. */
-	if (count % mtd->writesize != 0) {
-		printf("misaligned stream read, count=0x%llx, writesize=0x%x",
-		       count, mtd->writesize);
-		return -EINVAL;
-	}
-
 	uint8_t *cur_buffer = buffer;
 	uint64_t remaining = count;
 
@@ -60,18 +104,17 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 		stream_debug("Iteration 0x%llx 0x%llx 0x%llx %p\n",
 			     remaining, mtd_stream->offset, mtd_stream->limit,
 			     cur_buffer);
-		assert(remaining + mtd_stream->offset <= mtd_stream->limit);
-		if (remaining + mtd_stream->offset == mtd_stream->limit) {
+		if (mtd_stream->offset >= mtd_stream->limit) {
 			printf(
 			       "read out of bounds remaining=0x%llx offset=0x%llx limit=0x%llx",
 			       remaining, mtd_stream->offset,
 			       mtd_stream->limit);
-			return 0;
+			return count - remaining;
 		}
 
 		/* Skip a bad block */
 		if (mtd_stream->offset % mtd->erasesize == 0) {
-			if (mtd->block_isbad(mtd, mtd_stream->offset)) {
+			if (mtd_block_isbad(mtd, mtd_stream->offset)) {
 				printf("skipping bad block at 0x%llx\n",
 				       mtd_stream->offset);
 				mtd_stream->offset += mtd->erasesize;
@@ -79,23 +122,32 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 			}
 		}
 
-		/* Read up to the end of the current erase block or to
-		 * the end of the user request, whichever comes first. */
-		int length = MIN(ALIGN_UP(mtd_stream->offset + 1,
-					  mtd->erasesize),
-				 mtd_stream->offset + remaining)
-				- mtd_stream->offset;
-		unsigned int retlen;
-		int ret = mtd->read(mtd, mtd_stream->offset, length, &retlen,
-				    cur_buffer);
-		if (ret < 0 && ret != -EUCLEAN) {
-			printf("Read failure!! ret=%d\n", ret);
-			return ret;
-		}
-		if (retlen != length) {
-			printf("Read failure!! retlen=%d\n", retlen);
-			return count - remaining + retlen;
+		uint64_t page_offset = mtd_stream->offset % mtd->writesize;
+		/* Never read past the end of the stream. */
+		uint64_t wanted = MIN(remaining,
+				      mtd_stream->limit - mtd_stream->offset);
+		uint64_t length;
+		int ret;
+
+		if (page_offset || wanted < mtd->writesize) {
+			/* Pages can only be read whole, so buffer this one. */
+			length = MIN(wanted, mtd->writesize - page_offset);
+			ret = read_mtd_partial_page(mtd_stream, length,
+						    cur_buffer);
+		} else {
+			/* Read whole pages up to the end of the current erase
+			 * block or to the end of the user request, whichever
+			 * comes first. */
+			length = MIN(ALIGN_UP(mtd_stream->offset + 1,
+					      mtd->erasesize),
+				     mtd_stream->offset +
+				     ALIGN_DOWN(wanted, mtd->writesize))
+				 - mtd_stream->offset;
+			ret = read_mtd_chunk(mtd_stream, length, cur_buffer);
 		}
+		if (ret)
+			return ret;
+
 		mtd_stream->offset += length;
 		remaining -= length;
 		cur_buffer += length;
@@ -106,7 +158,10 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 
 static void close_mtd_stream(StreamOps *me)
 {
-	free(container_of(me, MtdStream, ops));
+	MtdStream *mtd_stream = container_of(me, MtdStream, ops);
+
+	free(mtd_stream->page_buf);
+	free(mtd_stream);
 }
 
 static StreamOps *open_mtd_stream(StreamCtrlr *me, uint64_t offset,
@@ -139,6 +194,7 @@ static StreamOps *open_mtd_stream(StreamCtrlr *me, uint64_t offset,
 	dev->mtd = ctrlr->mtd_ctrlr->dev;
 	dev->offset = offset;
 	dev->limit = offset + size;
+	dev->page_buf_offset = ~0ULL;
 	return &dev->ops;
 }
 
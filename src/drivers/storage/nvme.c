@@ -20,29 +20,28 @@
  * processed one at a time, therefore the Admin Queue pair only supports depth
  * 2.
  * This driver is limited to a single IO queue pair (in addition to the
- * mandatory Admin queue pair). The IO queue depth is configurable, but has
- * shallow defaults to minimize host memory consumption. This driver only
- * supports a maximum of one PRP List, limiting the maximum transfer size to
- * 2MB (assuming 4KB memory pages).
+ * mandatory Admin queue pair). Since depthcharge polls from a single thread,
+ * additional queue pairs would not add parallelism; instead the one IO queue
+ * is made as deep as CAP.MQES and a single page of queue memory allow.
+ * Chained PRP Lists extend the maximum transfer size to just under 4MB
+ * (assuming 4KB memory pages), further limited by the controller's MDTS.
  *
  * Operation:
  * At initialization this driver allocates a pool of host memory and overlays
- * the queue pair structures. It also statically allocates a block of memory
- * for a PRP List, avoiding the need to allocate/free memory at IO time.
+ * the queue pair structures. It also allocates a chain of PRP Lists per
+ * command id, sized for the largest transfer the controller accepts, avoiding
+ * the need to allocate/free memory at IO time.
  * Each identified NVMe namespace has a corresponding depthcharge BlockDev
  * structure, effectively creating a new "drive" visible to higher levels.
  *
  * The depthcharge read/write callbacks split host requests into chunks
- * satisfying the NVMe device's maximum transfer size limitations. Then they
- * call the corresponding _internal_ functions to facilitate formatting of the
- * NVMe structures in host memory. After all of the commands have been created
- * in host memory the Submission Queue tail pointer is updated allowing the
- * drive to process the newly submitted commands. Queuing commands allows the
- * drive to internally optimize accesses, increasing performance. Finally, the
- * Completion Queue phase bit is polled until it inverts, indicating that the
- * command has completed. If the SQ is full, outstanding commands will be
- * completed before the _internal_ function proceeds. This situation reduces
- * effective performance and should be avoided by increasing SQ/CQ depth.
+ * satisfying the NVMe device's maximum transfer size limitations. Each chunk
+ * is formatted in host memory and the Submission Queue tail doorbell is rung
+ * immediately, so the drive starts processing while the next chunk is built.
+ * When the SQ fills up, only the completions already posted (or at least
+ * one) are reaped before the next chunk is queued, keeping the drive busy
+ * with a full queue. Once all chunks are queued, the Completion Queue phase
+ * bit is polled until every outstanding command has completed.
  */
 
 #include <assert.h>
@@ -52,6 +51,7 @@
 #include <stdio.h>
 
 #include "base/cleanup_funcs.h"
+#include "base/init_funcs.h"
 #include "drivers/storage/blockdev.h"
 #include "drivers/storage/nvme.h"
 
@@ -115,28 +115,39 @@ static NVME_STATUS nvme_disable_controller(NvmeCtrlr *ctrlr) {
 	return NVME_SUCCESS;
 }
 
-/* Enables controller and verifies that it's ready */
-static NVME_STATUS nvme_enable_controller(NvmeCtrlr *ctrlr) {
+/* Enables controller, without waiting for it to become ready */
+static void nvme_start_controller(NvmeCtrlr *ctrlr) {
 	NVME_CC cc = 0;
-	uint32_t timeout;
 
 	SET(cc, NVME_CC_EN);
 	cc |= NVME_CC_IOSQES(6); /* Spec. recommended values */
 	cc |= NVME_CC_IOCQES(4); /* Spec. recommended values */
 	/* Write controller configuration. */
 	writel_with_flush(cc, ctrlr->ctrlr_regs + NVME_CC_OFFSET);
+	ctrlr->enable_us = timer_us(0);
+	ctrlr->enabled = 1;
+}
 
-	/* Delay up to CAP.TO ms for CSTS.RDY to set*/
+static int nvme_controller_ready(NvmeCtrlr *ctrlr) {
+	return (readl(ctrlr->ctrlr_regs + NVME_CSTS_OFFSET) & NVME_CSTS_RDY) != 0;
+}
+
+/* How many ms the controller may take to become ready after enabling it */
+static uint32_t nvme_ready_timeout(NvmeCtrlr *ctrlr) {
 	if (NVME_CAP_TO(ctrlr->cap) == 0)
-		timeout = 1;
-	else
-		timeout = NVME_CAP_TO(ctrlr->cap);
+		return 1;
+	return NVME_CAP_TO(ctrlr->cap);
+}
 
-	if (WAIT_WHILE(
-		((readl(ctrlr->ctrlr_regs + NVME_CSTS_OFFSET) & NVME_CSTS_RDY) == 0),
-		timeout)) {
+/* Verifies that the controller became ready within CAP.TO ms of enabling it */
+static NVME_STATUS nvme_wait_controller_ready(NvmeCtrlr *ctrlr) {
+	uint64_t waited = timer_us(ctrlr->enable_us) / 1000;
+	uint32_t timeout = nvme_ready_timeout(ctrlr);
+
+	timeout = waited < timeout ? timeout - waited : 0;
+
+	if (WAIT_WHILE(!nvme_controller_ready(ctrlr), timeout))
 		return NVME_TIMEOUT;
-	}
 
 	return NVME_SUCCESS;
 }
@@ -421,17 +432,34 @@ static NVME_STATUS nvme_create_sq(NvmeCtrlr *ctrlr, uint16_t qid, uint16_t qsize
 	return status;
 }
 
+/* Number of chained PRP Lists needed to describe size bytes starting at any
+ * offset within a page. PRP0 and PRP1 cover up to two pages without a list.
+ */
+static uint32_t nvme_prp_lists_needed(uint64_t size)
+{
+	uint64_t entries = ALIGN_UP(size, NVME_PAGE_SIZE) >> NVME_PAGE_SHIFT;
+
+	if (entries <= 1)
+		return 0;
+	/* All lists but the last give up one entry to the chain pointer */
+	return ALIGN_UP(entries - 1, PRP_ENTRIES_PER_LIST - 1) /
+		(PRP_ENTRIES_PER_LIST - 1);
+}
+
 /* Generate PRPs for a single virtual memory buffer
- * prp_list: pre-allocated prp list buffer
+ * prp_list: pre-allocated, physically contiguous chain of prp list buffers
+ * nlists: number of prp lists available in prp_list
  * prp: pointer to SQ PRP array
  * buffer: host buffer for request
  * size: number of bytes in request
  */
-static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint64_t *prp, void *buffer, uint64_t size)
+static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint32_t nlists,
+				 uint64_t *prp, void *buffer, uint64_t size)
 {
 	uint64_t offset = (uintptr_t)buffer & (NVME_PAGE_SIZE - 1);
 	uint64_t xfer_pages;
 	uintptr_t buffer_phys = virt_to_phys(buffer);
+	uint32_t entry_index = 0;
 
 	/* PRP0 is always the (potentially unaligned) start of the buffer */
 	prp[0] = buffer_phys;
@@ -447,60 +475,185 @@ static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint64_t *prp, void *buffer,
 		return NVME_SUCCESS;
 	}
 
-	/* Case 2: Need to build up to one PRP List */
+	/* Case 2: Need to build a chain of PRP Lists */
 	xfer_pages = (ALIGN((size + offset), NVME_PAGE_SIZE) >> NVME_PAGE_SHIFT);
 	/* Don't count first prp entry as it is the beginning of buffer */
 	xfer_pages--;
-	/* Make sure this transfer fits into one PRP list */
-	if (xfer_pages > (NVME_MAX_XFER_BYTES/NVME_PAGE_SIZE))
+	/* Make sure this transfer fits into the pre-allocated PRP Lists */
+	if (nvme_prp_lists_needed(xfer_pages << NVME_PAGE_SHIFT) > nlists)
 		return NVME_INVALID_PARAMETER;
 
-	/* Fill the PRP List */
+	/* Fill the PRP List(s) */
 	prp[1] = (uintptr_t)virt_to_phys(prp_list);
-	for (uint32_t entry_index = 0; entry_index < xfer_pages; entry_index++) {
-		prp_list->prp_entry[entry_index] = buffer_phys;
+	while (xfer_pages--) {
+		/* Chain to the next list if more than one entry is left */
+		if (entry_index == PRP_ENTRIES_PER_LIST - 1 && xfer_pages) {
+			prp_list->prp_entry[entry_index] =
+				(uintptr_t)virt_to_phys(prp_list + 1);
+			prp_list++;
+			entry_index = 0;
+		}
+		prp_list->prp_entry[entry_index++] = buffer_phys;
 		buffer_phys += NVME_PAGE_SIZE;
 	}
 	return NVME_SUCCESS;
 }
 
-/* Sets up read operation for up to max_transfer blocks */
-static NVME_STATUS nvme_internal_read(NvmeDrive *drive, void *buffer, lba_t start, lba_t count)
+/* Account for an IO command id belonging to an asynchronous request.
+ * Finishes the request once its last command is done.
+ */
+static void nvme_retire_req(NvmeCtrlr *ctrlr, uint16_t cid, int failed)
+{
+	BlockDevRequest *req = ctrlr->io_req[cid];
+
+	if (!req)
+		return;
+
+	ctrlr->io_req[cid] = NULL;
+	if (failed)
+		req->status = -1;
+	if (--req->pending == 0)
+		blockdev_request_done(req);
+}
+
+/* Give up on every IO command in flight after a timeout
+ * The controller could still complete them later, into buffers that have been
+ * handed back to their owners, so it is disabled and not used again. Pending
+ * asynchronous requests are failed.
+ */
+static void nvme_abandon_io(NvmeCtrlr *ctrlr)
+{
+	printf("nvme: IO timed out, disabling controller\n");
+
+	for (uint16_t cid = 0; cid < NVME_CSQ_SIZE; cid++)
+		nvme_retire_req(ctrlr, cid, 1);
+	ctrlr->io_cid_busy = 0;
+	ctrlr->io_inflight = 0;
+
+	if (ctrlr->enabled && NVME_ERROR(nvme_disable_controller(ctrlr)))
+		printf("nvme: failed to disable controller\n");
+	ctrlr->enabled = 0;
+}
+
+/* Reap IO completions from HW
+ * Consumes every completion entry that is already posted, releasing the
+ * command ids (and PRP Lists) of the finished commands. If wait is set and
+ * nothing has completed yet, polls until at least one command completes.
+ * Errors of commands belonging to asynchronous requests are reported
+ * through the request rather than the return value. On timeout, all IO in
+ * flight is abandoned with nvme_abandon_io().
+ *
+ * ctrlr: NVMe controller handle
+ * wait: Block until at least one completion has been reaped
+ */
+static NVME_STATUS nvme_reap_io(NvmeCtrlr *ctrlr, int wait)
+{
+	const uint16_t qid = NVME_IO_QUEUE_INDEX;
+	NVME_STATUS status = NVME_SUCCESS;
+	uint32_t reaped = 0;
+	NVME_CQ *cq;
+	uint16_t flags;
+	int failed;
+
+	while (ctrlr->io_inflight) {
+		cq = ctrlr->cq_buffer[qid] + ctrlr->cq_h_dbl[qid];
+
+		if ((readw(&(cq->flags)) & NVME_CQ_FLAGS_PHASE) == ctrlr->pt[qid]) {
+			/* Nothing posted yet */
+			if (!wait || reaped)
+				break;
+			if (WAIT_WHILE(
+				((readw(&(cq->flags)) & NVME_CQ_FLAGS_PHASE) == ctrlr->pt[qid]),
+				NVME_GENERIC_TIMEOUT)) {
+				printf("nvme_reap_io: ERROR - timeout\n");
+				nvme_abandon_io(ctrlr);
+				return NVME_TIMEOUT;
+			}
+		}
+
+		/* Dump completion entry status for debugging. */
+		DEBUG(nvme_dump_status(cq);)
+
+		flags = readw(&(cq->flags));
+		failed = NVME_CQ_FLAGS_SC(flags) || NVME_CQ_FLAGS_SCT(flags);
+		if (failed) {
+			printf("nvme_reap_io: cid %u failed, sct=%u sc=%u\n",
+			       cq->cid, NVME_CQ_FLAGS_SCT(flags),
+			       NVME_CQ_FLAGS_SC(flags));
+			if (!ctrlr->io_req[cq->cid])
+				status = NVME_DEVICE_ERROR;
+		}
+
+		nvme_retire_req(ctrlr, cq->cid, failed);
+		ctrlr->io_cid_busy &= ~(1ULL << cq->cid);
+		ctrlr->io_inflight--;
+		/* Update SQ head pointer */
+		ctrlr->sqhd[qid] = cq->sqhd;
+
+		/* Update the doorbell and queue phase if necessary */
+		if (++(ctrlr->cq_h_dbl[qid]) > (ctrlr->iocq_sz - 1)) {
+			ctrlr->cq_h_dbl[qid] = 0;
+			ctrlr->pt[qid] ^= 1;
+		}
+		reaped++;
+	}
+
+	/* Ring the completion queue doorbell register */
+	if (reaped)
+		writel_with_flush(ctrlr->cq_h_dbl[qid], ctrlr->ctrlr_regs +
+				  NVME_CQHDBL_OFFSET(qid, NVME_CAP_DSTRD(ctrlr->cap)));
+
+	return status;
+}
+
+/* Sets up a read or write operation for up to max_transfer blocks
+ * The command is added to the host SQ and the doorbell is rung right away so
+ * the drive starts working on it while the next command is built. If the SQ
+ * is full, only as many in-flight commands as necessary are completed to make
+ * room, keeping the rest of the queue busy.
+ */
+static NVME_STATUS nvme_internal_rw(NvmeDrive *drive, uint8_t opc,
+				    void *buffer, lba_t start, lba_t count,
+				    BlockDevRequest *req)
 {
 	NvmeCtrlr *ctrlr = drive->ctrlr;
 	NVME_SQ *sq;
+	uint16_t cid;
 	int status = NVME_SUCCESS;
 
 	if (count == 0)
 		return NVME_INVALID_PARAMETER;
+	if (!ctrlr->enabled)
+		return NVME_DEVICE_ERROR;
 
 	/* If queue is full, need to complete inflight commands before submitting more */
-	if ((ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX] + 1) % ctrlr->iosq_sz == ctrlr->sqhd[NVME_IO_QUEUE_INDEX]) {
-		DEBUG(printf("nvme_internal_read: Too many outstanding commands. Completing in-flights\n");)
-		/* Submit commands to controller */
-		nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-		/* Complete submitted command(s) */
-		status = nvme_complete_cmds_polled(ctrlr,
-				NVME_IO_QUEUE_INDEX,
-				NVME_CCQ_SIZE,
-				NVME_GENERIC_TIMEOUT);
+	if (ctrlr->io_inflight >= ctrlr->iosq_sz - 1) {
+		DEBUG(printf("nvme_internal_rw: Queue full. Reaping completions\n");)
+		status = nvme_reap_io(ctrlr, 1);
 		if (NVME_ERROR(status)) {
-			printf("nvme_internal_read: error %d completing outstanding commands\n",status);
+			printf("nvme_internal_rw: error %d completing outstanding commands\n",status);
 			return status;
 		}
 	}
 
+	/* Pick a command id whose PRP Lists are not in use */
+	for (cid = 0; cid < ctrlr->iosq_sz; cid++)
+		if (!(ctrlr->io_cid_busy & (1ULL << cid)))
+			break;
+	assert(cid < ctrlr->iosq_sz);
+
 	sq  = ctrlr->sq_buffer[NVME_IO_QUEUE_INDEX] + ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX];
 
 	memset(sq, 0, sizeof(NVME_SQ));
 
-	sq->opc = NVME_IO_READ_OPC;
-	sq->cid = ctrlr->cid[NVME_IO_QUEUE_INDEX]++;
+	sq->opc = opc;
+	sq->cid = cid;
 	sq->nsid = drive->namespace_id;
 
-	status = nvme_fill_prp(ctrlr->prp_list[sq->cid], sq->prp, buffer, count * drive->dev.block_size);
+	status = nvme_fill_prp(ctrlr->prp_list[cid], ctrlr->prp_lists_per_cmd,
+			       sq->prp, buffer, count * drive->dev.block_size);
 	if (NVME_ERROR(status)) {
-		printf("nvme_internal_read: error %d generating PRP(s)\n",status);
+		printf("nvme_internal_rw: error %d generating PRP(s)\n",status);
 		return status;
 	}
 
@@ -509,168 +662,144 @@ static NVME_STATUS nvme_internal_read(NvmeDrive *drive, void *buffer, lba_t star
 	sq->cdw12 = (count - 1) & 0xFFFF;
 
 	status = nvme_submit_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
+	if (NVME_ERROR(status))
+		return status;
 
-	return status;
+	ctrlr->io_cid_busy |= 1ULL << cid;
+	ctrlr->io_inflight++;
+	ctrlr->io_req[cid] = req;
+	if (req)
+		req->pending++;
+
+	return nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
 }
 
-/* Read operation entrypoint
- * Cut operation into max_transfer chunks and do it
+/* Read/write operation common path
+ * Cut operation into max_transfer chunks, keep the SQ full while chunks
+ * are outstanding, then wait for all of them to complete.
  */
-static lba_t nvme_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
+static lba_t nvme_rw(NvmeDrive *drive, uint8_t opc, lba_t start, lba_t count,
+		     void *buffer)
 {
-	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 	NvmeCtrlr *ctrlr = drive->ctrlr;
-	uint64_t max_transfer_blocks = 0;
 	uint32_t block_size = drive->dev.block_size;
+	uint64_t max_transfer_blocks = ctrlr->max_transfer_bytes / block_size;
 	lba_t orig_count = count;
+	lba_t chunk;
 	int status = NVME_SUCCESS;
 
-	DEBUG(printf("nvme_read: Reading from namespace %d\n",drive->namespace_id);)
-
-	if (ctrlr->controller_data->mdts != 0)
-		max_transfer_blocks = ((1 << (ctrlr->controller_data->mdts)) * (1 << NVME_CAP_MPSMIN(ctrlr->cap))) / block_size;
-	/* Artificially limit max_transfer_blocks to 1 PRP List */
-	if ( (max_transfer_blocks == 0) ||
-			(max_transfer_blocks > (NVME_MAX_XFER_BYTES * block_size)))
-		max_transfer_blocks = NVME_MAX_XFER_BYTES / block_size;
+	/* NLB in CDW12 is a 16-bit field */
+	if (max_transfer_blocks > 0x10000)
+		max_transfer_blocks = 0x10000;
 
 	while (count > 0) {
-		if (count > max_transfer_blocks) {
-			DEBUG(printf("nvme_read: partial read of %llu blocks\n",(unsigned long long)max_transfer_blocks);)
-			status = nvme_internal_read(drive, buffer, start, max_transfer_blocks);
-			count -= max_transfer_blocks;
-			buffer += max_transfer_blocks*block_size;
-			start += max_transfer_blocks;
-		} else {
-			DEBUG(printf("nvme_read: final read of %llu blocks\n",(unsigned long long)count);)
-			status = nvme_internal_read(drive, buffer, start, count);
-			count = 0;
-		}
+		chunk = MIN(count, max_transfer_blocks);
+		DEBUG(printf("nvme_rw: opc %u, %llu blocks at lba %llu\n", opc,
+			     (unsigned long long)chunk, (unsigned long long)start);)
+		status = nvme_internal_rw(drive, opc, buffer, start, chunk,
+					  NULL);
 		if (NVME_ERROR(status))
 			break;
+		count -= chunk;
+		buffer += chunk * block_size;
+		start += chunk;
 	}
 
-	if (NVME_ERROR(status)) {
-		printf("nvme_read: error %d\n",status);
-		return -1;
+	/* Complete submitted command(s), even if a later submission failed */
+	while (ctrlr->io_inflight) {
+		int reap_status = nvme_reap_io(ctrlr, 1);
+		if (NVME_ERROR(reap_status)) {
+			status = reap_status;
+			if (reap_status == NVME_TIMEOUT)
+				break;
+		}
 	}
 
-	/* Submit commands to controller */
-	nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-	/* Complete submitted command(s) */
-	nvme_complete_cmds_polled(ctrlr,
-			NVME_IO_QUEUE_INDEX,
-			NVME_CCQ_SIZE,
-			NVME_GENERIC_TIMEOUT);
+	DEBUG(printf("nvme_rw: lba = 0x%08x, Original = 0x%08x, Remaining = 0x%08x, BlockSize = 0x%x Status = %d\n", (uint32_t)start, (uint32_t)orig_count, (uint32_t)count, block_size, status);)
 
-	DEBUG(printf("nvme_read: lba = 0x%08x, Original = 0x%08x, Remaining = 0x%08x, BlockSize = 0x%x Status = %d\n", (uint32_t)start, (uint32_t)orig_count, (uint32_t)count, block_size, status);)
+	if (NVME_ERROR(status)) {
+		printf("nvme_rw: error %d\n",status);
+		return -1;
+	}
 
 	return orig_count - count;
 }
 
-/* Sets up write operation for up to max_transfer blocks */
-static NVME_STATUS nvme_internal_write(NvmeDrive *drive, void *buffer, lba_t start, lba_t count)
+/* Asynchronous request entrypoint
+ * Queues the request as max_transfer chunks and returns without waiting.
+ * The request holds an extra reference while its chunks are being queued,
+ * so reaping completions to make room cannot finish it early.
+ */
+static int nvme_submit(BlockDevOps *me, BlockDevRequest *req)
 {
-	NvmeCtrlr *ctrlr = drive->ctrlr;
-	NVME_SQ *sq;
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
+	uint32_t block_size = drive->dev.block_size;
+	uint64_t max_transfer_blocks =
+		MIN(drive->ctrlr->max_transfer_bytes / block_size, 0x10000);
+	uint8_t opc = req->is_write ? NVME_IO_WRITE_OPC : NVME_IO_READ_OPC;
+	uint8_t *buffer = req->buffer;
+	lba_t start = req->start;
+	lba_t count = req->count;
 	int status = NVME_SUCCESS;
+	int queued = 0;
 
-	if (count == 0)
-		return NVME_INVALID_PARAMETER;
+	req->pending++;
+	while (count > 0) {
+		lba_t chunk = MIN(count, max_transfer_blocks);
 
-	/* If queue is full, need to complete inflight commands before submitting more */
-	if ((ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX] + 1) % ctrlr->iosq_sz == ctrlr->sqhd[NVME_IO_QUEUE_INDEX]) {
-		DEBUG(printf("nvme_internal_write: Too many outstanding commands. Completing in-flights\n");)
-		/* Submit commands to controller */
-		nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-		/* Complete submitted command(s) */
-		status = nvme_complete_cmds_polled(ctrlr,
-				NVME_IO_QUEUE_INDEX,
-				NVME_CCQ_SIZE,
-				NVME_GENERIC_TIMEOUT);
-		if (NVME_ERROR(status)) {
-			printf("nvme_internal_read: error %d completing outstanding commands\n",status);
-			return status;
-		}
+		status = nvme_internal_rw(drive, opc, buffer, start, chunk,
+					  req);
+		if (NVME_ERROR(status))
+			break;
+		queued = 1;
+		count -= chunk;
+		buffer += chunk * block_size;
+		start += chunk;
 	}
+	req->pending--;
 
-	sq  = ctrlr->sq_buffer[NVME_IO_QUEUE_INDEX] + ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX];
-
-	memset(sq, 0, sizeof(NVME_SQ));
-
-	sq->opc = NVME_IO_WRITE_OPC;
-	sq->cid = ctrlr->cid[NVME_IO_QUEUE_INDEX]++;
-	sq->nsid = drive->namespace_id;
-
-	status = nvme_fill_prp(ctrlr->prp_list[sq->cid], sq->prp, buffer, count * drive->dev.block_size);
 	if (NVME_ERROR(status)) {
-		printf("nvme_internal_write: error %d generating PRP(s)\n",status);
-		return status;
+		printf("nvme_submit: error %d\n", status);
+		if (!queued)
+			return -1;
+		req->status = -1;
 	}
 
-	sq->cdw10 = start;
-	sq->cdw11 = (start >> 32);
-	sq->cdw12 = (count - 1) & 0xFFFF;
-
-	status = nvme_submit_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
-
-	return status;
+	if (!req->pending)
+		blockdev_request_done(req);
+	return 0;
 }
 
-/* Write operation entrypoint
- * Cut operation into max_transfer chunks and do it
+/* Asynchronous completion entrypoint
+ * On timeout nvme_reap_io() fails every outstanding request, since the
+ * controller is not going to complete them.
  */
-static lba_t nvme_write(BlockDevOps *me, lba_t start, lba_t count,
-						const void *buffer)
+static void nvme_poll(BlockDevOps *me, int wait)
 {
 	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
-	NvmeCtrlr *ctrlr = drive->ctrlr;
-	uint64_t max_transfer_blocks = 0;
-	uint32_t block_size = drive->dev.block_size;
-	lba_t orig_count = count;
-	int status = NVME_SUCCESS;
 
-	DEBUG(printf("nvme_write: Writing to namespace %d\n",drive->namespace_id);)
+	nvme_reap_io(drive->ctrlr, wait);
+}
 
-	if (ctrlr->controller_data->mdts != 0)
-		max_transfer_blocks = ((1 << (ctrlr->controller_data->mdts)) * (1 << NVME_CAP_MPSMIN(ctrlr->cap))) / block_size;
-	/* Artificially limit max_transfer_blocks to 1 PRP List */
-	if ( (max_transfer_blocks == 0) ||
-			(max_transfer_blocks > (NVME_MAX_XFER_BYTES * block_size)))
-		max_transfer_blocks = NVME_MAX_XFER_BYTES / block_size;
+/* Read operation entrypoint */
+static lba_t nvme_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
+{
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 
-	while (count > 0) {
-		if (count > max_transfer_blocks) {
-			DEBUG(printf("nvme_write: partial write of %llu blocks\n",(unsigned long long)max_transfer_blocks);)
-			status = nvme_internal_write(drive, (void *)buffer, start, max_transfer_blocks);
-			count -= max_transfer_blocks;
-			buffer += max_transfer_blocks*block_size;
-			start += max_transfer_blocks;
-		} else {
-			DEBUG(printf("nvme_write final write of %llu blocks\n",(unsigned long long)count);)
-			status = nvme_internal_write(drive, (void *)buffer, start, count);
-			count = 0;
-		}
-		if (NVME_ERROR(status))
-			break;
-	}
+	DEBUG(printf("nvme_read: Reading from namespace %d\n",drive->namespace_id);)
 
-	if (NVME_ERROR(status)) {
-		printf("nvme_write: error %d\n",status);
-		return -1;
-	}
+	return nvme_rw(drive, NVME_IO_READ_OPC, start, count, buffer);
+}
 
-	/* Submit commands to controller */
-	nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-	/* Complete submitted command(s) */
-	nvme_complete_cmds_polled(ctrlr,
-			NVME_IO_QUEUE_INDEX,
-			NVME_CCQ_SIZE,
-			NVME_GENERIC_TIMEOUT);
+/* Write operation entrypoint */
+static lba_t nvme_write(BlockDevOps *me, lba_t start, lba_t count,
+						const void *buffer)
+{
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 
-	DEBUG(printf("nvme_write: lba = 0x%08x, Original = 0x%08x, Remaining = 0x%08x, BlockSize = 0x%x Status = %d\n", (uint32_t)start, (uint32_t)orig_count, (uint32_t)count, block_size, status);)
+	DEBUG(printf("nvme_write: Writing to namespace %d\n",drive->namespace_id);)
 
-	return orig_count - count;
+	return nvme_rw(drive, NVME_IO_WRITE_OPC, start, count, (void *)buffer);
 }
 
 /* Sends the Identify command, saves result in ctrlr->controller_data*/
@@ -734,6 +863,8 @@ static NVME_STATUS nvme_create_drive(NvmeCtrlr *ctrlr, uint32_t namespace_id,
 	nvme_drive->dev.ops.read = &nvme_read;
 	nvme_drive->dev.ops.write = &nvme_write;
 	nvme_drive->dev.ops.new_stream = &new_simple_stream;
+	nvme_drive->dev.ops.submit = &nvme_submit;
+	nvme_drive->dev.ops.poll = &nvme_poll;
 	nvme_drive->dev.name = name;
 	nvme_drive->dev.removable = 0;
 	nvme_drive->dev.block_size = block_size;
@@ -841,38 +972,42 @@ static NvmeModelData *nvme_match_static_model(NvmeCtrlr *ctrlr)
 	return NULL;
 }
 
-/* Initialization entrypoint */
-static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
+/* Checks whether dev is an NVMe device, or a root port with one behind it.
+ * Returns the device, or 0 if there is none.
+ */
+static pcidev_t nvme_find_dev(pcidev_t dev)
 {
-	NvmeCtrlr *ctrlr = container_of(me, NvmeCtrlr, ctrlr.ops);
-	pcidev_t dev = ctrlr->dev;
-	int status = NVME_SUCCESS;
+	if (is_nvme_ctrlr(dev))
+		return dev;
 
-	/* If this is not an NVMe device, check if it is a root port */
-	if (!is_nvme_ctrlr(dev)) {
-		uint8_t header_type = pci_read_config8(dev, REG_HEADER_TYPE);
-		header_type &= 0x7f;
-		if (header_type != HEADER_TYPE_BRIDGE) {
-			status = NVME_NOT_FOUND;
-			printf("PCIe bridge not found @ %02x:%02x:%02x\n",
-			       PCI_BUS(dev), PCI_SLOT(dev), PCI_FUNC(dev));
-			goto exit;
-		}
+	uint8_t header_type = pci_read_config8(dev, REG_HEADER_TYPE);
+	if ((header_type & 0x7f) != HEADER_TYPE_BRIDGE)
+		return 0;
 
-		/* Look for NVMe device on this root port */
-		uint32_t bus = pci_read_config32(dev, REG_PRIMARY_BUS);
-		bus = (bus >> 8) & 0xff;
-		dev = PCI_DEV(bus, 0, 0);
-		if (!is_nvme_ctrlr(dev)) {
-			status = NVME_NOT_FOUND;
-			printf("NVMe device not found @ %02x:%02x:%02x\n",
-			       PCI_BUS(dev), PCI_SLOT(dev), PCI_FUNC(dev));
-			goto exit;
-		}
+	/* Look for NVMe device on this root port */
+	uint32_t bus = pci_read_config32(dev, REG_PRIMARY_BUS);
+	bus = (bus >> 8) & 0xff;
+	dev = PCI_DEV(bus, 0, 0);
+	return is_nvme_ctrlr(dev) ? dev : 0;
+}
 
-		/* Update the device pointer */
-		ctrlr->dev = dev;
+/* Finds the controller, sets up its admin queues and enables it
+ * Doesn't wait for the controller to become ready, so this can be done early
+ * by nvme_start_ctrlrs() while other code runs.
+ */
+static NVME_STATUS nvme_ctrlr_start(NvmeCtrlr *ctrlr)
+{
+	pcidev_t dev = nvme_find_dev(ctrlr->dev);
+	NVME_STATUS status;
+
+	if (!dev) {
+		printf("NVMe device not found @ %02x:%02x:%02x\n",
+		       PCI_BUS(ctrlr->dev), PCI_SLOT(ctrlr->dev),
+		       PCI_FUNC(ctrlr->dev));
+		return NVME_NOT_FOUND;
 	}
+	/* Update the device pointer */
+	ctrlr->dev = dev;
 
 	printf("Initializing NVMe controller %04x:%04x\n",
 		pci_read_config16(ctrlr->dev, REG_VENDOR_ID),
@@ -888,15 +1023,13 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	/* Verify that the NVM command set is supported */
 	if (NVME_CAP_CSS(ctrlr->cap) != NVME_CAP_CSS_NVM) {
 		printf("NVMe Cap CSS not NVMe (CSS=%01x.\n",(uint8_t)NVME_CAP_CSS(ctrlr->cap));
-		status = NVME_UNSUPPORTED;
-		goto exit;
+		return NVME_UNSUPPORTED;
 	}
 
 	/* Driver only supports 4k page size */
 	if (NVME_CAP_MPSMIN(ctrlr->cap) > NVME_PAGE_SHIFT) {
 		printf("NVMe driver only supports 4k page size.\n");
-		status = NVME_UNSUPPORTED;
-		goto exit;
+		return NVME_UNSUPPORTED;
 	}
 
 	/* Calculate max io sq/cq sizes based on MQES */
@@ -904,30 +1037,21 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	ctrlr->iocq_sz = (NVME_CCQ_SIZE > NVME_CAP_MQES(ctrlr->cap)) ? NVME_CAP_MQES(ctrlr->cap) : NVME_CCQ_SIZE;
 	DEBUG(printf("iosq_sz = %u, iocq_sz = %u\n",ctrlr->iosq_sz,ctrlr->iocq_sz);)
 
-	/* Allocate enough PRP List memory for max queue depth commands */
-	for (unsigned int list_index = 0; list_index < ctrlr->iosq_sz; list_index++) {
-		ctrlr->prp_list[list_index] = dma_memalign(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
-		if (!(ctrlr->prp_list[list_index])) {
-			printf("NVMe driver failed to allocate prp list %u memory\n",list_index);
-			status = NVME_OUT_OF_RESOURCES;
-			goto exit;
-		}
-		memset(ctrlr->prp_list[list_index], 0, NVME_PAGE_SIZE);
-	}
-
 	/* Allocate queue memory block */
 	ctrlr->buffer = dma_memalign(NVME_PAGE_SIZE, (NVME_NUM_QUEUES * 2) * NVME_PAGE_SIZE);
 	if (!(ctrlr->buffer)) {
 		printf("NVMe driver failed to allocate queue buffer\n");
-		status = NVME_OUT_OF_RESOURCES;
-		goto exit;
+		return NVME_OUT_OF_RESOURCES;
 	}
 	memset(ctrlr->buffer, 0, (NVME_NUM_QUEUES * 2) * NVME_PAGE_SIZE);
 
 	/* Disable controller */
 	status = nvme_disable_controller(ctrlr);
-	if (NVME_ERROR(status))
-		goto exit;
+	if (NVME_ERROR(status)) {
+		free(ctrlr->buffer);
+		ctrlr->buffer = NULL;
+		return status;
+	}
 
 	/* Create Admin queue pair */
 	NVME_AQA aqa = 0;
@@ -947,6 +1071,10 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	#if (NVME_CCQ_SIZE < 2) || (NVME_CCQ_SIZE > (NVME_PAGE_SIZE / 64))
 	#error "Unsupported IO CQ size defined"
 	#endif
+	/* In-flight command ids are tracked in a 64-bit mask */
+	#if NVME_CSQ_SIZE > 64
+	#error "IO SQ size exceeds command id tracking"
+	#endif
 
 	/* Set number of entries Admin submission & completion queues. */
 	aqa |= NVME_AQA_ASQS(NVME_ASQ_SIZE);
@@ -978,10 +1106,26 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	writell(acq, ctrlr->ctrlr_regs + NVME_ACQ_OFFSET);
 
 	/* Enable controller */
-	status = nvme_enable_controller(ctrlr);
+	nvme_start_controller(ctrlr);
+
+	return NVME_SUCCESS;
+}
+
+/* Initialization entrypoint */
+static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
+{
+	NvmeCtrlr *ctrlr = container_of(me, NvmeCtrlr, ctrlr.ops);
+	int status = NVME_SUCCESS;
+
+	if (!ctrlr->enabled) {
+		status = nvme_ctrlr_start(ctrlr);
+		if (NVME_ERROR(status))
+			goto exit;
+	}
+
+	status = nvme_wait_controller_ready(ctrlr);
 	if (NVME_ERROR(status))
 		goto exit;
-	ctrlr->enabled = 1;
 
 	/* Set IO queue count */
 	status = nvme_set_queue_count(ctrlr, NVME_NUM_IO_QUEUES);
@@ -1002,6 +1146,32 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	if (NVME_ERROR(status))
 		goto exit;
 
+	/* Limit the transfer size to MDTS and the PRP Lists we can chain */
+	ctrlr->max_transfer_bytes = NVME_MAX_XFER_BYTES;
+	if (ctrlr->controller_data->mdts != 0 &&
+	    ctrlr->controller_data->mdts + NVME_CAP_MPSMIN(ctrlr->cap) < 32)
+		ctrlr->max_transfer_bytes = MIN(NVME_MAX_XFER_BYTES,
+			1UL << (ctrlr->controller_data->mdts +
+				NVME_CAP_MPSMIN(ctrlr->cap)));
+	ctrlr->prp_lists_per_cmd =
+		nvme_prp_lists_needed(ctrlr->max_transfer_bytes);
+	DEBUG(printf("max_transfer_bytes = %u, prp_lists_per_cmd = %u\n",
+		     ctrlr->max_transfer_bytes, ctrlr->prp_lists_per_cmd);)
+
+	/* Allocate enough PRP List memory for max queue depth commands */
+	for (unsigned int list_index = 0;
+	     ctrlr->prp_lists_per_cmd && list_index < ctrlr->iosq_sz;
+	     list_index++) {
+		size_t size = ctrlr->prp_lists_per_cmd * NVME_PAGE_SIZE;
+		ctrlr->prp_list[list_index] = dma_memalign(NVME_PAGE_SIZE, size);
+		if (!(ctrlr->prp_list[list_index])) {
+			printf("NVMe driver failed to allocate prp list %u memory\n",list_index);
+			status = NVME_OUT_OF_RESOURCES;
+			goto exit;
+		}
+		memset(ctrlr->prp_list[list_index], 0, size);
+	}
+
 	NvmeModelData *model = nvme_match_static_model(ctrlr);
 	if (model) {
 		/* Create drive based on static namespace data */
@@ -1052,7 +1222,8 @@ static int nvme_shutdown(struct CleanupFunc *cleanup, CleanupType type)
 		free(drive);
 	}
 	free(ctrlr->controller_data);
-	free(ctrlr->prp_list);
+	for (unsigned int list_index = 0; list_index < NVME_CSQ_SIZE; list_index++)
+		free(ctrlr->prp_list[list_index]);
 	free(ctrlr->buffer);
 	free(ctrlr);
 	return 0;
@@ -1071,6 +1242,29 @@ void nvme_add_static_namespace(NvmeCtrlr *ctrlr, uint32_t namespace_id,
 	list_insert_after(&data->list_node, &ctrlr->static_model_data);
 }
 
+/* Enable the NVMe controllers the board registered once everything else is
+ * set up, so they can come ready in the background instead of on first use.
+ * Waiting for them and finishing initialization is left to nvme_ctrlr_init(),
+ * and controllers which aren't there are left for it to report.
+ */
+static int nvme_start_ctrlrs(void)
+{
+	BlockDevCtrlr *blk;
+
+	list_for_each(blk, fixed_block_dev_controllers, list_node) {
+		if (blk->ops.update != &nvme_ctrlr_init || !blk->need_update)
+			continue;
+
+		NvmeCtrlr *ctrlr = container_of(blk, NvmeCtrlr, ctrlr);
+		if (!ctrlr->enabled && nvme_find_dev(ctrlr->dev))
+			nvme_ctrlr_start(ctrlr);
+	}
+
+	return 0;
+}
+
+INIT_FUNC_DEFERRED(nvme_start_ctrlrs);
+
 /* Setup controller initialization/shutdown callbacks.
  * Used in board.c to get handle to new ctrlr.
  */
@@ -39,8 +39,8 @@
 #define NVME_PAGE_SHIFT		12
 #define NVME_PAGE_SIZE		(1UL << NVME_PAGE_SHIFT)
 
-/* Max 1 PRP list per transfer */
-#define MAX_PRP_LISTS 1
+/* Max PRP lists chained together per transfer */
+#define MAX_PRP_LISTS 2
 /* 8 bytes per entry */
 #define PRP_ENTRY_SHIFT 3
 /* 1 page per list */
@@ -48,7 +48,11 @@
 /* 1 page of memory addressed per entry*/
 #define PRP_ENTRY_XFER_SHIFT NVME_PAGE_SHIFT
 #define PRP_ENTRIES_PER_LIST (1UL << (PRP_LIST_SHIFT - PRP_ENTRY_SHIFT))
-#define NVME_MAX_XFER_BYTES  ((MAX_PRP_LISTS * PRP_ENTRIES_PER_LIST ) << PRP_ENTRY_XFER_SHIFT)
+/* The last entry of every list but the final one points to the next list.
+ * One data entry per list is reserved so that an unaligned buffer of
+ * NVME_MAX_XFER_BYTES still fits.
+ */
+#define NVME_MAX_XFER_BYTES  ((MAX_PRP_LISTS * (PRP_ENTRIES_PER_LIST - 1)) << PRP_ENTRY_XFER_SHIFT)
 
 /* Loop used to poll for command completions
  * timeout in milliseconds
@@ -90,8 +94,8 @@ typedef int NVME_STATUS;
 #define NVME_ASQ_SIZE	2	/* Number of admin submission queue entries, only 2 */
 #define NVME_ACQ_SIZE	2	/* Number of admin completion queue entries, only 2 */
 
-#define NVME_CSQ_SIZE	15	/* Number of I/O submission queue entries per queue, min 2, max 64 */
-#define NVME_CCQ_SIZE	15	/* Number of I/O completion queue entries per queue, min 2, max 64 */
+#define NVME_CSQ_SIZE	32	/* Number of I/O submission queue entries per queue, min 2, max 64 */
+#define NVME_CCQ_SIZE	32	/* Number of I/O completion queue entries per queue, min 2, max 64 */
 
 #define NVME_NUM_QUEUES	2	/* Number of queues (Admin + IO) supported by the driver, only 2 supported */
 #define NVME_NUM_IO_QUEUES	(NVME_NUM_QUEUES - 1) /* Number of IO queues (not counting Admin Queue) */
@@ -342,7 +346,9 @@ typedef struct NvmeCtrlr {
 	BlockDevCtrlr ctrlr;
 	ListNode drives;
 
+	/* CC.EN was set, at enable_us */
 	int enabled;
+	uint64_t enable_us;
 	pcidev_t dev;
 	uint32_t ctrlr_regs;
 
@@ -355,8 +361,12 @@ typedef struct NvmeCtrlr {
 	/* virtual address of identify controller data */
 	NVME_ADMIN_CONTROLLER_DATA *controller_data;
 
-	/* virtual address of pre-allocated PRP Lists */
+	/* virtual address of pre-allocated PRP Lists, one chain per cid */
 	PrpList *prp_list[NVME_CSQ_SIZE];
+	/* number of chained PRP Lists allocated for each cid */
+	uint32_t prp_lists_per_cmd;
+	/* largest transfer per command, limited by MDTS and PRP Lists */
+	uint32_t max_transfer_bytes;
 
 	/* virtual address of raw buffer, split into queues below */
 	uint8_t *buffer;
@@ -373,6 +383,12 @@ typedef struct NvmeCtrlr {
 	uint16_t sqhd[NVME_NUM_QUEUES];
 	/* current command id for each queue */
 	uint16_t cid[NVME_NUM_QUEUES];
+	/* bitmap of IO command ids (and their PRP Lists) still in flight */
+	uint64_t io_cid_busy;
+	/* number of IO commands submitted but not yet completed */
+	uint16_t io_inflight;
+	/* asynchronous request each IO command id belongs to, if any */
+	BlockDevRequest *io_req[NVME_CSQ_SIZE];
 
 	/* Actual IO SQ size accounting for MQES */
 	uint16_t iosq_sz;
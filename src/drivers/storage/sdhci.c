@@ -843,6 +843,19 @@ static int sdhci_update(BlockDevCtrlrOps *me)
 	return 0;
 }
 
+static int sdhci_media_changed(BlockDevCtrlrOps *me)
+{
+	SdhciHost *host = container_of
+		(me, SdhciHost, mmc_ctrlr.ctrlr.ops);
+
+	if (!host->removable)
+		return 1;
+
+	int present = (sdhci_readl(host, SDHCI_PRESENT_STATE) &
+		       SDHCI_CARD_PRESENT) != 0;
+	return present != (host->mmc_ctrlr.media != NULL);
+}
+
 void add_sdhci(SdhciHost *host)
 {
 	host->mmc_ctrlr.send_cmd = &sdhci_send_command;
@@ -850,6 +863,7 @@ void add_sdhci(SdhciHost *host)
 
 	host->mmc_ctrlr.ctrlr.ops.is_bdev_owned = block_mmc_is_bdev_owned;
 	host->mmc_ctrlr.ctrlr.ops.update = &sdhci_update;
+	host->mmc_ctrlr.ctrlr.ops.media_changed = &sdhci_media_changed;
 	host->mmc_ctrlr.ctrlr.need_update = 1;
 
 	/* TODO(vbendeb): check if SDHCI spec allows to retrieve this value. */
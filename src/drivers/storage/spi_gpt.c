@@ -193,6 +193,7 @@ static int spi_gpt_fixup(DeviceTreeFixup *fixup, DeviceTree *tree)
 		list_insert_after(&partition->list_node, prev_child);
 		prev_child = &partition->list_node;
 	}
+	dt_invalidate_indexes();
 	WriteAndFreeGptData(dev, gpt);
 
 	return 0;
@@ -44,6 +44,7 @@ enum {
 	Cr50TimeoutShort = 2 * 1000,		// usecs
 	Cr50TimeoutNoIrq = 20 * 1000,		// usecs
 	Cr50TimeoutIrq = 100 * 1000,		// usecs
+	Cr50PollMin = 50,			// usecs
 };
 
 enum {
@@ -383,6 +384,7 @@ static int cr50_i2c_wait_burststs(Cr50I2c *tpm, uint8_t mask,
 {
 	uint32_t buf;
 	uint64_t start = timer_us(0);
+	unsigned poll_us = Cr50PollMin;
 
 	while (timer_us(start) < Cr50TimeoutLong) {
 
@@ -399,7 +401,12 @@ static int cr50_i2c_wait_burststs(Cr50I2c *tpm, uint8_t mask,
 		    *burst > 0 && *burst <= Cr50MaxBufSize)
 			return 0;
 
-		udelay(Cr50TimeoutShort);
+		/*
+		 * Every status read already waits for the ready interrupt,
+		 * so only back off gradually while cr50 is busy.
+		 */
+		udelay(poll_us);
+		poll_us = MIN(poll_us * 2, Cr50TimeoutShort);
 	}
 
 	printf("%s: Timeout reading burst status\n", __func__);
@@ -120,6 +120,13 @@ typedef struct {
 	unsigned char body[4];
 } spi_frame_header;
 
+/*
+ * cr50 goes to sleep when the bus has been idle for a while, and needs a CS
+ * pulse to wake it up. Skip the pulse while it's known to be awake.
+ */
+#define TPM_WAKE_IDLE_USECS (100 * 1000)
+static uint64_t last_transaction_us;
+
 static int tpm_irq_status(void)
 {
 	if (!spi_tpm.irq_status) {
@@ -166,11 +173,15 @@ static int start_transaction(int read_write, size_t bytes, unsigned addr)
 	/* Wait for tpm to finish previous transaction */
 	tpm_sync();
 
-	/* Try to wake cr50 if it is asleep. */
-	tpm_if.cs_assert(tpm_if.slave);
-	udelay(1);
-	tpm_if.cs_deassert(tpm_if.slave);
-	udelay(100);
+	/* Try to wake cr50 if it may have gone to sleep. */
+	if (!last_transaction_us ||
+	    timer_us(last_transaction_us) > TPM_WAKE_IDLE_USECS) {
+		tpm_if.cs_assert(tpm_if.slave);
+		udelay(1);
+		tpm_if.cs_deassert(tpm_if.slave);
+		udelay(100);
+	}
+	last_transaction_us = timer_us(0);
 
 	/*
 	 * The first byte of the frame header encodes the transaction type
@@ -446,14 +457,22 @@ static int tpm2_init(SpiOps *spi_ops)
  * failure.
  */
 #define MAX_STATUS_TIMEOUT 120
+/*
+ * Most commands finish well within a millisecond, so start polling quickly and
+ * back off to once a millisecond for the slow ones.
+ */
+#define MIN_STATUS_POLL_USECS 10
+#define MAX_STATUS_POLL_USECS 1000
 static int wait_for_status(uint32_t status_mask, uint32_t status_expected)
 {
 	uint32_t status;
 	struct stopwatch sw;
+	unsigned poll_us = MIN_STATUS_POLL_USECS;
 
 	stopwatch_init_usecs_expire(&sw, MAX_STATUS_TIMEOUT * USECS_PER_SEC);
 	do {
-		udelay(MSECS_PER_SEC);
+		udelay(poll_us);
+		poll_us = MIN(poll_us * 2, MAX_STATUS_POLL_USECS);
 		if (stopwatch_expired(&sw)) {
 			printf("failed to get expected status %x\n",
 			       status_expected);
@@ -478,21 +497,23 @@ union fifo_transfer_buffer {
 
 /*
  * Transfer requested number of bytes to or from TPM FIFO, accounting for the
- * current burst count value.
+ * current burst count value. The TPM can take a whole burst without being
+ * asked again, so the burst count is only read once the last one is used up,
+ * and frames go out back to back in between.
  */
 static void fifo_transfer(size_t transfer_size,
 			  union fifo_transfer_buffer buffer,
 			  enum fifo_transfer_direction direction)
 {
 	size_t transaction_size;
-	size_t burst_count;
+	size_t burst_count = 0;
 	size_t handled_so_far = 0;
 
 	do {
-		do {
+		while (!burst_count) {
 			/* Could be zero when TPM is busy. */
 			burst_count = get_burst_count();
-		} while (!burst_count);
+		}
 
 		transaction_size = transfer_size - handled_so_far;
 		transaction_size = MIN(transaction_size, burst_count);
@@ -513,6 +534,7 @@ static void fifo_transfer(size_t transfer_size,
 				       transaction_size);
 
 		handled_so_far += transaction_size;
+		burst_count -= transaction_size;
 
 	} while (handled_so_far != transfer_size);
 }
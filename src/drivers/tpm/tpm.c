@@ -17,6 +17,7 @@
 
 #include <libpayload.h>
 
+#include "base/profile.h"
 #include "config.h"
 #include "drivers/tpm/tpm.h"
 
@@ -35,7 +36,13 @@ int tpm_xmit(const uint8_t *sendbuf, size_t send_size,
 	     uint8_t *recvbuf, size_t *recv_len)
 {
 	die_if(!tpm_ops, "%s: No TPM ops set.\n", __func__);
-	return tpm_ops->xmit(tpm_ops, sendbuf, send_size, recvbuf, recv_len);
+
+	// Time each command, since they sit on the verified boot path.
+	int span = profile_begin("tpm command", tpm_ops->xmit);
+	int ret = tpm_ops->xmit(tpm_ops, sendbuf, send_size, recvbuf,
+				recv_len);
+	profile_end_bytes(span, send_size + (ret ? 0 : *recv_len));
+	return ret;
 }
 
 char *tpm_report_state(void)
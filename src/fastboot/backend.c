@@ -18,6 +18,7 @@
 #include <libpayload.h>
 
 #include "base/gpt.h"
+#include "boot/crc32.h"
 #include "config.h"
 #include "fastboot/backend.h"
 
@@ -180,6 +181,9 @@ static backend_ret_t write_sparse_image(struct image_part_details *img,
 	uint64_t part_addr = img->part_addr;
 	uint64_t part_size_lba = img->part_size_lba;
 	BlockDevOps *ops = &img->bdev_entry->bdev->ops;
+	/* CRC32 of the unsparsed image so far, checked by CRC32 chunks */
+	uint32_t crc = 0;
+	static const uint32_t zero;
 
 	/* Perform the following operation on each chunk */
 	for (i = 0; i < img_hdr->total_chunks; i++) {
@@ -235,6 +239,7 @@ static backend_ret_t write_sparse_image(struct image_part_details *img,
 			    != chunk_size_lba)
 				return BE_WRITE_ERR;
 
+			crc = crc32(crc, data_ptr, chunk_size_bytes);
 			break;
 		}
 		case CHUNK_TYPE_FILL: {
@@ -265,6 +270,8 @@ static backend_ret_t write_sparse_image(struct image_part_details *img,
 			    != chunk_size_lba)
 				return BE_WRITE_ERR;
 
+			crc = crc32_repeat(crc, data_fill, sizeof(*data_fill),
+					   chunk_size_bytes / sizeof(*data_fill));
 			break;
 		}
 		case CHUNK_TYPE_DONT_CARE: {
@@ -280,6 +287,10 @@ static backend_ret_t write_sparse_image(struct image_part_details *img,
 				       chunk_hdr->total_size_bytes);
 				return BE_CHUNK_HDR_ERR;
 			}
+
+			/* Skipped blocks count as zeroes */
+			crc = crc32_repeat(crc, &zero, sizeof(zero),
+					   chunk_size_bytes / sizeof(zero));
 			break;
 		}
 		case CHUNK_TYPE_CRC32: {
@@ -296,11 +307,18 @@ static backend_ret_t write_sparse_image(struct image_part_details *img,
 				return BE_CHUNK_HDR_ERR;
 			}
 
-			/* TODO(furquan): Verify CRC32 header? */
-
 			/* Data present in chunk sparse image = 4 bytes */
-			if (img_buff_advance(&buff, sizeof(uint32_t)) == NULL)
+			uint32_t *data_crc = img_buff_advance(&buff,
+							      sizeof(*data_crc));
+			if (data_crc == NULL)
 				return BE_IMAGE_INSUFFICIENT_DATA;
+
+			/* It covers everything up to this point */
+			if (le32toh(*data_crc) != crc) {
+				BE_LOG("crc32:%x\n", crc);
+				BE_LOG("chunk crc32:%x\n", le32toh(*data_crc));
+				return BE_CRC_ERR;
+			}
 			break;
 		}
 		default: {
@@ -38,6 +38,7 @@ typedef enum {
 	BE_CHUNK_HDR_ERR,
 	BE_GPT_ERR,
 	BE_INVALID_SLOT_INDEX,
+	BE_CRC_ERR,
 	BE_NOT_HANDLED,
 } backend_ret_t;
 
@@ -992,6 +992,7 @@ const char *backend_error_string[] = {
 	[BE_CHUNK_HDR_ERR] = "sparse chunk header error",
 	[BE_GPT_ERR] = "GPT error",
 	[BE_INVALID_SLOT_INDEX] = "Invalid slot index",
+	[BE_CRC_ERR] = "sparse image CRC32 mismatch",
 };
 
 static fb_ret_type fb_erase(struct fb_cmd *cmd)
@@ -112,7 +112,9 @@ int try_dhcp(uip_ipaddr_t *my_ip,
 	return 0;
 }
 
-void netboot(uip_ipaddr_t *tftp_ip, char *bootfile, char *argsfile, char *args)
+// Bring up the network stack and find out where the TFTP server is.
+static void netboot_setup(uip_ipaddr_t **tftp_ip, uip_ipaddr_t *next_ip,
+			  uip_ipaddr_t *server_ip, const char **dhcp_bootfile)
 {
 	net_wait_for_link();
 
@@ -120,19 +122,59 @@ void netboot(uip_ipaddr_t *tftp_ip, char *bootfile, char *argsfile, char *args)
 	uip_init();
 
 	// Find out who we are.
-	uip_ipaddr_t my_ip, next_ip, server_ip;
-	const char *dhcp_bootfile;
-	while (try_dhcp(&my_ip, &next_ip, &server_ip, &dhcp_bootfile))
+	uip_ipaddr_t my_ip;
+	while (try_dhcp(&my_ip, next_ip, server_ip, dhcp_bootfile))
 		printf("Dhcp failed, retrying.\n");
 
-	if (!tftp_ip) {
-		tftp_ip = &next_ip;
+	if (!*tftp_ip) {
+		*tftp_ip = next_ip;
 		printf("TFTP server IP supplied by DHCP server: ");
 	} else {
 		printf("TFTP server IP predefined by user: ");
 	}
-	print_ip_addr(tftp_ip);
+	print_ip_addr(*tftp_ip);
 	printf("\n");
+}
+
+int netboot_install(uip_ipaddr_t *tftp_ip, const char *file, BlockDev *dev,
+		    lba_t start)
+{
+	uip_ipaddr_t next_ip, server_ip;
+	const char *dhcp_bootfile;
+	uint64_t size;
+	int ret = 0;
+
+	if (start >= dev->block_count) {
+		printf("Block %lld is past the end of %s.\n", start, dev->name);
+		return -1;
+	}
+
+	netboot_setup(&tftp_ip, &next_ip, &server_ip, &dhcp_bootfile);
+	if (!file)
+		file = dhcp_bootfile;
+	printf("Installing %s to %s at block %lld.\n", file, dev->name,
+	       start);
+
+	if (tftp_read_sink(new_tftp_blockdev_sink(dev, start), tftp_ip, file,
+			   &size, (dev->block_count - start) * dev->block_size)) {
+		printf("Tftp failed.\n");
+		ret = -1;
+	} else {
+		printf("The image was %lld bytes long.\n", size);
+	}
+
+	if (dhcp_release(server_ip)) {
+		printf("Dhcp release failed.\n");
+		ret = -1;
+	}
+	return ret;
+}
+
+void netboot(uip_ipaddr_t *tftp_ip, char *bootfile, char *argsfile, char *args)
+{
+	uip_ipaddr_t next_ip, server_ip;
+	const char *dhcp_bootfile;
+	netboot_setup(&tftp_ip, &next_ip, &server_ip, &dhcp_bootfile);
 
 	// Download the bootfile.
 	uint32_t size;
@@ -15,10 +15,14 @@
 #ifndef __NETBOOT_NETBOOT_H__
 #define __NETBOOT_NETBOOT_H__
 
+#include "drivers/storage/blockdev.h"
 #include "net/uip.h"
 
 /* argsfile takes precedence before args. All parameters can be NULL. */
 void netboot(uip_ipaddr_t *tftp_ip, char *bootfile, char *argsfile, char *args);
+/* Write a file fetched over TFTP to dev, starting at block start. */
+int netboot_install(uip_ipaddr_t *tftp_ip, const char *file, BlockDev *dev,
+		    lba_t start);
 int netboot_entry(void);
 int try_dhcp(uip_ipaddr_t *my_ip,
 	     uip_ipaddr_t *next_ip,
@@ -35,11 +35,22 @@ typedef enum TftpStatus
 
 static TftpStatus tftp_status;
 
-static uint8_t *tftp_dest;
+static TftpSink *tftp_sink;
 static int tftp_got_response;
 static int tftp_blocknum;
-static uint32_t tftp_total_size;
-static uint32_t tftp_max_size;
+static uint64_t tftp_total_size;
+static uint64_t tftp_max_size;
+
+// Parameters of the current transfer, possibly negotiated through an OACK.
+static int tftp_negotiating;
+static int tftp_option_refused;
+static int tftp_blksize;
+static int tftp_windowsize;
+// The last block we sent an ack for.
+static int tftp_acked;
+
+// How long to wait for the rest of a window before acking what we have.
+static const uint64_t TftpWindowTimeoutUs = 250 * 1000;
 
 typedef struct TftpAckPacket
 {
@@ -96,6 +107,47 @@ static void tftp_print_error_pkt(void)
 	}
 }
 
+static void tftp_send_ack(int blocknum)
+{
+	TftpAckPacket ack = {
+		htonw(TftpAck),
+		htonw(blocknum)
+	};
+	memcpy(uip_appdata, &ack, sizeof(ack));
+	uip_udp_send(sizeof(ack));
+	tftp_acked = blocknum;
+}
+
+// Apply the options the server accepted. Returns 0 on success.
+static int tftp_handle_oack(void)
+{
+	char *opt = (char *)uip_appdata + 2;
+	char *end = (char *)uip_appdata + uip_datalen();
+
+	while (opt < end) {
+		char *val = memchr(opt, 0, end - opt);
+		if (!val || ++val >= end || !memchr(val, 0, end - val))
+			break;
+
+		uint64_t num = strtoull(val, NULL, 10);
+		if (!strcasecmp(opt, "blksize")) {
+			if (num < 8 || num > TFTP_MAX_BLOCK_SIZE)
+				return -1;
+			tftp_blksize = num;
+		} else if (!strcasecmp(opt, "windowsize")) {
+			if (num < 1 || num > TftpMaxWindowSize)
+				return -1;
+			tftp_windowsize = num;
+		} else if (!strcasecmp(opt, "tsize") &&
+			   num > tftp_max_size) {
+			printf("TFTP transfer too large.\n");
+			return -1;
+		}
+		opt = val + strlen(val) + 1;
+	}
+	return 0;
+}
+
 static void tftp_callback(void)
 {
 	// If there isn't at least an opcode, ignore the packet.
@@ -118,13 +170,41 @@ static void tftp_callback(void)
 
 	// If there was an error, report it and stop the transfer.
 	if (opcode == TftpError) {
+		uint16_t error = 0;
+		if (uip_datalen() >= 4) {
+			memcpy(&error, (uint8_t *)uip_appdata + 2,
+				sizeof(error));
+			error = ntohw(error);
+		}
+		// Servers may refuse our options outright. Ask again without.
+		if (tftp_negotiating && error == TftpOptionRefused) {
+			tftp_option_refused = 1;
+			return;
+		}
 		tftp_status = TftpFailure;
 		printf(" error!\n");
 		tftp_print_error_pkt();
 		return;
 	}
 
-	// We should only get data packets. Those are at least 4 bytes long.
+	// The server accepted some of our options.
+	if (opcode == TftpOptionAck) {
+		if (!tftp_negotiating)
+			return;
+		tftp_negotiating = 0;
+		if (tftp_handle_oack()) {
+			printf("Bad TFTP option ack.\n");
+			tftp_status = TftpFailure;
+			return;
+		}
+		// Acking block 0 starts the transfer.
+		tftp_send_ack(0);
+		tftp_got_response = 1;
+		return;
+	}
+
+	// Otherwise we should only get data packets. Those are at least 4
+	// bytes long.
 	if (opcode != TftpData || uip_datalen() < 4)
 		return;
 
@@ -133,16 +213,29 @@ static void tftp_callback(void)
 	memcpy(&blocknum, (uint8_t *)uip_appdata + 2, sizeof(blocknum));
 	blocknum = ntohw(blocknum);
 
-	// Ignore blocks which are duplicated or out of order, taking into
-	// account 16-bit block number overflow.
-	if (blocknum != (tftp_blocknum & 0xFFFF))
+	// Data for block 1 without an OACK means the server ignored our
+	// options and is doing a classic transfer.
+	if (tftp_negotiating && blocknum == 1) {
+		tftp_negotiating = 0;
+		tftp_blksize = TftpDefaultBlockSize;
+		tftp_windowsize = TftpDefaultWindowSize;
+	}
+
+	// Ignore blocks which are duplicated, taking into account 16-bit
+	// block number overflow. If a block in the window went missing, ack
+	// the last one we got so the server resends from there.
+	uint16_t ahead = blocknum - (tftp_blocknum & 0xFFFF);
+	if (ahead) {
+		if (ahead < 0x8000 && tftp_acked != tftp_blocknum - 1)
+			tftp_send_ack(tftp_blocknum - 1);
 		return;
+	}
 
 	void *new_data = (uint8_t *)uip_appdata + 4;
 	int new_data_len = uip_datalen() - 4;
 
 	// If the block is too big, reject it.
-	if (new_data_len > TftpMaxBlockSize)
+	if (new_data_len > tftp_blksize)
 		return;
 
 	// If we're out of space give up.
@@ -152,61 +245,115 @@ static void tftp_callback(void)
 		return;
 	}
 
-	// If there's any data, copy it in.
-	if (new_data_len) {
-		memcpy(tftp_dest, new_data, new_data_len);
-		tftp_dest += new_data_len;
+	// If there's any data, pass it on.
+	if (new_data_len &&
+	    tftp_sink->write(tftp_sink, new_data, new_data_len)) {
+		tftp_status = TftpFailure;
+		printf("Storing TFTP data failed.\n");
+		return;
 	}
+
+	// Give some feedback that something is happening.
+	if ((tftp_total_size + new_data_len) / (10 * TftpDefaultBlockSize) !=
+	    tftp_total_size / (10 * TftpDefaultBlockSize))
+		printf("#");
 	tftp_total_size += new_data_len;
 
 	// If this block was less than the maximum size, the transfer is done.
-	if (new_data_len < TftpMaxBlockSize) {
+	// Ack it anyway so the server doesn't keep resending it.
+	if (new_data_len < tftp_blksize) {
+		tftp_send_ack(tftp_blocknum);
 		tftp_status = TftpSuccess;
 		return;
 	}
 
-	// Prepare an ack.
-	TftpAckPacket ack = {
-		htonw(TftpAck),
-		htonw(tftp_blocknum)
-	};
-	memcpy(uip_appdata, &ack, sizeof(ack));
-	uip_udp_send(sizeof(ack));
+	// Ack once per window.
+	if (tftp_blocknum - tftp_acked >= tftp_windowsize)
+		tftp_send_ack(tftp_blocknum);
 
 	// Move on to the next block.
 	tftp_blocknum++;
-
-	if (!(tftp_blocknum % 10)) {
-		// Give some feedback that something is happening.
-		printf("#");
-	}
 	tftp_got_response = 1;
 }
 
-int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
-	uint32_t *size, uint32_t max_size)
+// Build a read request, optionally asking for a bigger block and window.
+static int tftp_build_read_req(uint8_t *read_req, const char *bootfile,
+			       int with_options)
 {
-	// Build the read request packet.
 	uint16_t opcode = htonw(TftpReadReq);
-	int opcode_len = sizeof(opcode);
+	int len = 0;
+
+	memcpy(read_req, &opcode, sizeof(opcode));
+	len += sizeof(opcode);
+	len += sprintf((char *)read_req + len, "%s", bootfile) + 1;
+	len += sprintf((char *)read_req + len, "Octet") + 1;
+
+	if (with_options) {
+		len += sprintf((char *)read_req + len, "blksize") + 1;
+		len += sprintf((char *)read_req + len, "%d",
+			       TFTP_MAX_BLOCK_SIZE) + 1;
+		len += sprintf((char *)read_req + len, "windowsize") + 1;
+		len += sprintf((char *)read_req + len, "%d",
+			       TftpMaxWindowSize) + 1;
+		len += sprintf((char *)read_req + len, "tsize") + 1;
+		len += sprintf((char *)read_req + len, "0") + 1;
+	}
 
-	int name_len = strlen(bootfile) + 1;
+	return len;
+}
+
+typedef struct TftpMemSink
+{
+	TftpSink sink;
+	uint8_t *dest;
+} TftpMemSink;
 
-	const char mode[] = "Octet";
-	int mode_len = sizeof(mode);
+static int tftp_mem_write(TftpSink *me, const void *data, uint32_t size)
+{
+	TftpMemSink *mem = container_of(me, TftpMemSink, sink);
 
-	int read_req_len = opcode_len + name_len + mode_len;
-	uint8_t *read_req = xmalloc(read_req_len);
+	memcpy(mem->dest, data, size);
+	mem->dest += size;
+	return 0;
+}
 
-	memcpy(read_req, &opcode, opcode_len);
-	memcpy(read_req + opcode_len, bootfile, name_len);
-	memcpy(read_req + opcode_len + name_len, mode, mode_len);
+static int tftp_mem_close(TftpSink *me)
+{
+	return 0;
+}
+
+int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
+	uint32_t *size, uint32_t max_size)
+{
+	TftpMemSink mem = {
+		.sink = {
+			.write = &tftp_mem_write,
+			.close = &tftp_mem_close,
+		},
+		.dest = dest,
+	};
+	uint64_t total;
+
+	if (tftp_read_sink(&mem.sink, server_ip, bootfile, &total, max_size))
+		return -1;
+	if (size)
+		*size = total;
+	return 0;
+}
+
+int tftp_read_sink(TftpSink *sink, uip_ipaddr_t *server_ip,
+		   const char *bootfile, uint64_t *size, uint64_t max_size)
+{
+	// Build the read request packet, with room for the options.
+	uint8_t *read_req = xmalloc(strlen(bootfile) + 64);
+	int read_req_len = tftp_build_read_req(read_req, bootfile, 1);
 
 	// Set up the UDP connection.
 	struct uip_udp_conn *conn = uip_udp_new(server_ip, htonw(TftpPort));
 	if (!conn) {
 		printf("Failed to set up UDP connection.\n");
 		free(read_req);
+		sink->close(sink);
 		return -1;
 	}
 
@@ -219,22 +366,43 @@ int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 	// Prepare for the transfer.
 	printf("Waiting for the transfer... ");
 	tftp_status = TftpPending;
-	tftp_dest = dest;
+	tftp_sink = sink;
 	tftp_blocknum = 1;
+	tftp_acked = 0;
 	tftp_total_size = 0;
 	tftp_max_size = max_size;
+	tftp_negotiating = 1;
+	tftp_option_refused = 0;
+	tftp_blksize = TftpDefaultBlockSize;
+	tftp_windowsize = TftpDefaultWindowSize;
 
 	// Poll the network driver until the transaction is done.
 
 	net_set_callback(&tftp_callback);
+	uint64_t last_response = timer_us(0);
 	while (tftp_status == TftpPending) {
 		tftp_got_response = 0;
 		net_poll();
-		if (tftp_got_response)
+		if (tftp_got_response) {
+			last_response = timer_us(0);
+			continue;
+		}
+
+		if (tftp_option_refused) {
+			// Start over with a classic read request.
+			printf("Server refused options, retrying... ");
+			tftp_option_refused = 0;
+			read_req_len = tftp_build_read_req(read_req, bootfile,
+							   0);
+		} else if (tftp_windowsize > 1 &&
+			   timer_us(last_response) < TftpWindowTimeoutUs) {
+			// The rest of the window may still be on its way.
 			continue;
+		}
+		last_response = timer_us(0);
 
 		// No response. Resend our last packet and try again.
-		if (tftp_blocknum == 1) {
+		if (tftp_negotiating) {
 			// Resend the read request.
 			conn->rport = htonw(TftpPort);
 			uip_udp_packet_send(conn, read_req, read_req_len);
@@ -246,12 +414,19 @@ int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 				htonw(tftp_blocknum - 1)
 			};
 			uip_udp_packet_send(conn, &ack, sizeof(ack));
+			tftp_acked = tftp_blocknum - 1;
 		}
 	}
 	uip_udp_remove(conn);
 	free(read_req);
 	net_set_callback(NULL);
 
+	// Let the sink finish up, e.g. write out what it still buffers.
+	if (sink->close(sink) && tftp_status == TftpSuccess) {
+		printf("Storing TFTP data failed.\n");
+		tftp_status = TftpFailure;
+	}
+
 	// See what happened.
 	if (tftp_status == TftpFailure) {
 		// The error was printed when it was received.
@@ -18,6 +18,7 @@
 #ifndef __NETBOOT_TFTP_H__
 #define __NETBOOT_TFTP_H__
 
+#include "drivers/storage/blockdev.h"
 #include "net/uip.h"
 
 typedef enum TftpOpcode
@@ -26,7 +27,8 @@ typedef enum TftpOpcode
 	TftpWriteReq = 2,
 	TftpData = 3,
 	TftpAck = 4,
-	TftpError = 5
+	TftpError = 5,
+	TftpOptionAck = 6
 } TftpOpcode;
 
 typedef enum TftpErrorCode
@@ -38,13 +40,37 @@ typedef enum TftpErrorCode
 	TftpIllegalOp = 4,
 	TftpUnknownId = 5,
 	TftpFileExists = 6,
-	TftpNoSuchUser = 7
+	TftpNoSuchUser = 7,
+	TftpOptionRefused = 8
 } TftpErrorCode;
 
 static const uint16_t TftpPort = 69;
-static const int TftpMaxBlockSize = 512;
+// Block size and window size of servers that don't negotiate (RFC 1350).
+static const int TftpDefaultBlockSize = 512;
+static const int TftpDefaultWindowSize = 1;
+// Largest block that fits in one frame, see RFC 2348.
+#define TFTP_MAX_BLOCK_SIZE \
+	(CONFIG_UIP_BUFSIZE - CONFIG_UIP_LLH_LEN - UIP_IPUDPH_LEN - 4)
+// Blocks the server may send before waiting for an ack, see RFC 7440.
+static const int TftpMaxWindowSize = 16;
+
+/*
+ * Destination for the data of a TFTP transfer. write() gets each block in
+ * order. close() is called once when the transfer ends, successful or not,
+ * and should release the sink. Both return 0 on success.
+ */
+typedef struct TftpSink
+{
+	int (*write)(struct TftpSink *me, const void *data, uint32_t size);
+	int (*close)(struct TftpSink *me);
+} TftpSink;
 
 int tftp_read(void *dest, uip_ipaddr_t *server_ip, const char *bootfile,
 	uint32_t *size, uint32_t max_size);
+int tftp_read_sink(TftpSink *sink, uip_ipaddr_t *server_ip,
+		   const char *bootfile, uint64_t *size, uint64_t max_size);
+
+/* Writes the transfer to a block device starting at block start. */
+TftpSink *new_tftp_blockdev_sink(BlockDev *dev, lba_t start);
 
 #endif /* __NETBOOT_TFTP_H__ */
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2018 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "drivers/storage/blockdev.h"
+#include "drivers/storage/bouncebuf.h"
+#include "netboot/tftp.h"
+
+/*
+ * TFTP blocks are collected into batches of this size before they are
+ * written out. While one batch is being written, the next one fills up.
+ */
+#define TFTP_BLOCKDEV_BATCH_BYTES	(1 * MiB)
+
+typedef struct TftpBlockDevSink
+{
+	TftpSink sink;
+	BlockDev *dev;
+	// Where the transfer started, and where the next batch goes.
+	lba_t start_lba;
+	lba_t next_lba;
+
+	uint8_t *buffer[2];
+	BlockDevRequest req[2];
+	int busy[2];
+	// The buffer being filled, and how much of it is.
+	int current;
+	uint32_t filled;
+
+	// Set once a batch couldn't be written, so nothing more is tried.
+	int failed;
+} TftpBlockDevSink;
+
+static void tftp_blockdev_write_done(BlockDevRequest *req)
+{
+	TftpBlockDevSink *bdev = req->data;
+
+	bdev->busy[req - bdev->req] = 0;
+	if (req->status)
+		bdev->failed = 1;
+}
+
+// Start writing out the current batch and switch to the other buffer.
+static int tftp_blockdev_flush(TftpBlockDevSink *bdev)
+{
+	unsigned block_size = bdev->dev->block_size;
+	lba_t count = ALIGN_UP(bdev->filled, block_size) / block_size;
+	BlockDevRequest *req = &bdev->req[bdev->current];
+
+	if (bdev->next_lba + count > bdev->dev->block_count) {
+		printf("TFTP transfer too large for %s.\n", bdev->dev->name);
+		bdev->failed = 1;
+		return -1;
+	}
+
+	// The final batch may end mid block. Pad it with zeroes.
+	memset(bdev->buffer[bdev->current] + bdev->filled, 0,
+	       count * block_size - bdev->filled);
+
+	req->is_write = 1;
+	req->start = bdev->next_lba;
+	req->count = count;
+	req->buffer = bdev->buffer[bdev->current];
+	req->complete = &tftp_blockdev_write_done;
+	req->data = bdev;
+
+	bdev->busy[bdev->current] = 1;
+	if (blockdev_submit(&bdev->dev->ops, req)) {
+		bdev->busy[bdev->current] = 0;
+		bdev->failed = 1;
+		return -1;
+	}
+
+	bdev->next_lba += count;
+	bdev->filled = 0;
+	bdev->current ^= 1;
+
+	// The other buffer has to be written out before it can be reused.
+	while (bdev->busy[bdev->current])
+		blockdev_poll(&bdev->dev->ops, 1);
+
+	return bdev->failed ? -1 : 0;
+}
+
+static int tftp_blockdev_write(TftpSink *me, const void *data, uint32_t size)
+{
+	TftpBlockDevSink *bdev = container_of(me, TftpBlockDevSink, sink);
+
+	while (size) {
+		uint32_t chunk = MIN(size, TFTP_BLOCKDEV_BATCH_BYTES -
+					   bdev->filled);
+
+		memcpy(bdev->buffer[bdev->current] + bdev->filled, data,
+		       chunk);
+		bdev->filled += chunk;
+		data = (const uint8_t *)data + chunk;
+		size -= chunk;
+
+		if (bdev->filled == TFTP_BLOCKDEV_BATCH_BYTES &&
+		    tftp_blockdev_flush(bdev))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int tftp_blockdev_close(TftpSink *me)
+{
+	TftpBlockDevSink *bdev = container_of(me, TftpBlockDevSink, sink);
+	int ret = 0;
+
+	if (bdev->filled && !bdev->failed && tftp_blockdev_flush(bdev))
+		ret = -1;
+
+	while (bdev->busy[0] || bdev->busy[1])
+		blockdev_poll(&bdev->dev->ops, 1);
+	if (bdev->failed)
+		ret = -1;
+	else if (!ret)
+		printf("Wrote %lld blocks at %lld to %s.\n",
+		       bdev->next_lba - bdev->start_lba, bdev->start_lba,
+		       bdev->dev->name);
+
+	free(bdev->buffer[0]);
+	free(bdev->buffer[1]);
+	free(bdev);
+	return ret;
+}
+
+TftpSink *new_tftp_blockdev_sink(BlockDev *dev, lba_t start)
+{
+	TftpBlockDevSink *bdev = xzalloc(sizeof(*bdev));
+
+	bdev->sink.write = &tftp_blockdev_write;
+	bdev->sink.close = &tftp_blockdev_close;
+	bdev->dev = dev;
+	bdev->start_lba = start;
+	bdev->next_lba = start;
+	bdev->buffer[0] = xmemalign(ARCH_DMA_MINALIGN,
+				    TFTP_BLOCKDEV_BATCH_BYTES);
+	bdev->buffer[1] = xmemalign(ARCH_DMA_MINALIGN,
+				    TFTP_BLOCKDEV_BATCH_BYTES);
+
+	return &bdev->sink;
+}
@@ -19,6 +19,7 @@
 #include <libpayload.h>
 #include <vboot_api.h>
 
+#include "base/profile.h"
 #include "base/timestamp.h"
 #include "drivers/storage/blockdev.h"
 #include "drivers/storage/stream.h"
@@ -80,11 +81,15 @@ VbError_t VbExDiskFreeInfo(VbDiskInfo *infos,
 VbError_t VbExDiskRead(VbExDiskHandle_t handle, uint64_t lba_start,
 		       uint64_t lba_count, void *buffer)
 {
-	BlockDevOps *ops = &((BlockDev *)handle)->ops;
+	BlockDev *bdev = (BlockDev *)handle;
+	BlockDevOps *ops = &bdev->ops;
+	int span = profile_begin("disk read", NULL);
 	if (ops->read(ops, lba_start, lba_count, buffer) != lba_count) {
+		profile_end(span);
 		printf("Read failed.\n");
 		return VBERROR_UNKNOWN;
 	}
+	profile_end_bytes(span, lba_count * bdev->block_size);
 	return VBERROR_SUCCESS;
 }
 
@@ -114,7 +119,10 @@ VbError_t VbExStreamOpen(VbExDiskHandle_t handle, uint64_t lba_start,
 VbError_t VbExStreamRead(VbExStream_t stream, uint32_t bytes, void *buffer)
 {
 	StreamOps *dev = (StreamOps *)stream;
+	uint64_t start = timer_us(0);
+	int span = profile_begin("stream read", NULL);
 	int ret = dev->read(dev, bytes, buffer);
+	profile_end_bytes(span, ret == bytes ? bytes : 0);
 	if (ret != bytes) {
 		printf("Stream read failed.\n");
 		return VBERROR_UNKNOWN;
@@ -123,8 +131,14 @@ VbError_t VbExStreamRead(VbExStream_t stream, uint32_t bytes, void *buffer)
 	// Vboot first reads some headers from the front of the kernel partition
 	// and then the whole kernel body in one call. We assume that any read
 	// larger than 1MB is the kernel body, and thus the last read.
-	if (bytes > MiB)
+	if (bytes > MiB) {
+		uint64_t us = timer_us(start);
+
 		timestamp_add_now(TS_VB_READ_KERNEL_DONE);
+		printf("Read %u KiB kernel body in %llu us (%llu MB/s).\n",
+		       bytes / KiB, (unsigned long long)us,
+		       (unsigned long long)profile_mbps(bytes, us));
+	}
 
 	return VBERROR_SUCCESS;
 }
@@ -40,7 +40,7 @@
 
 static struct cbfs_media *ro_cbfs;
 
-static void *get_file_from_cbfs(
+static const void *get_file_from_cbfs(
 	const char *filename, enum VbSelectFirmware_t select, size_t *size)
 {
 	if (!IS_ENABLED(CONFIG_DRIVER_CBFS_FLASH))
@@ -50,13 +50,11 @@ static void *get_file_from_cbfs(
 		printf("Trying to locate '%s' in RO CBFS\n", filename);
 		if (ro_cbfs == NULL)
 			ro_cbfs = cbfs_ro_media();
-		return cbfs_get_file_content(ro_cbfs, filename,
-					     CBFS_TYPE_RAW, size);
+		return cbfs_map_file(ro_cbfs, filename, CBFS_TYPE_RAW, size);
 	}
 
 	printf("Trying to locate '%s' in CBFS\n", filename);
-	return cbfs_get_file_content(CBFS_DEFAULT_MEDIA, filename,
-				     CBFS_TYPE_RAW, size);
+	return cbfs_map_file(CBFS_DEFAULT_MEDIA, filename, CBFS_TYPE_RAW, size);
 }
 
 int VbExTrustEC(int devidx)
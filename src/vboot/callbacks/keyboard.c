@@ -40,8 +40,10 @@ uint32_t VbExKeyboardRead(void)
 	// This is the only callback the vboot UI will continuously poll in dev
 	// mode. We need to update SD storage controllers to detect insertion or
 	// removal somewhere, and this is the only place we have, so we need to
-	// do it here even though it doesn't really fit well.
-	get_all_bdevs(BLOCKDEV_REMOVABLE, NULL);
+	// do it here even though it doesn't really fit well. Controllers with
+	// a card detect are only updated when it changes, everything else
+	// (USB) is rate limited.
+	blockdev_hotplug_poll();
 
 	// No input, just give up.
 	if (!havechar())
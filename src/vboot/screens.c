@@ -74,6 +74,18 @@ static int  prev_selected_index = -1;
 static struct directory *base_graphics;
 static struct directory *font_graphics;
 static struct cbfs_media *ro_cbfs;
+/*
+ * Font glyphs indexed by character, so strings don't need an archive search
+ * per character. Filled in as characters are first used.
+ */
+static struct {
+	char name[sizeof("idx127_7f.bmp")];
+	const void *bitmap;
+	uint32_t size;
+	/* scaled width, valid if it was computed for this height */
+	int32_t width;
+	int32_t height;
+} glyphs[128];
 static struct {
 	/* current locale */
 	uint32_t current;
@@ -102,57 +114,65 @@ struct menu {
 };
 
 /*
- * Load archive into RAM
+ * Map archive from CBFS. The archive is used in place and never modified.
  */
 static VbError_t load_archive(const char *name, struct directory **dest)
 {
 	struct directory *dir;
-	struct dentry *entry;
+	const struct dentry *entry;
 	size_t size;
 	int i;
 
 	printf("%s: loading %s\n", __func__, name);
 	*dest = NULL;
 
-	/* load archive from cbfs */
-	dir = cbfs_get_file_content(ro_cbfs, name, CBFS_TYPE_RAW, &size);
+	/* map archive from cbfs */
+	dir = (struct directory *)cbfs_map_file(ro_cbfs, name, CBFS_TYPE_RAW,
+						&size);
 	if (!dir || !size) {
 		printf("%s: failed to load %s\n", __func__, name);
-		return VBERROR_INVALID_BMPFV;
+		goto fail;
 	}
 
-	/* convert endianness of archive header */
-	dir->count = le32toh(dir->count);
-	dir->size = le32toh(dir->size);
-
 	/* validate the total size */
-	if (dir->size != size) {
+	if (le32toh(dir->size) != size) {
 		printf("%s: archive size does not match\n", __func__);
-		return VBERROR_INVALID_BMPFV;
+		goto fail;
 	}
 
 	/* validate magic field */
 	if (memcmp(dir->magic, CBAR_MAGIC, sizeof(CBAR_MAGIC))) {
 		printf("%s: invalid archive magic\n", __func__);
-		return VBERROR_INVALID_BMPFV;
+		goto fail;
 	}
 
 	/* validate count field */
-	if (get_first_offset(dir) > dir->size) {
+	if (get_first_offset(dir) > size) {
 		printf("%s: invalid count\n", __func__);
-		return VBERROR_INVALID_BMPFV;
+		goto fail;
 	}
 
-	/* convert endianness of file headers */
+	/* validate file headers */
 	entry = get_first_dentry(dir);
-	for (i = 0; i < dir->count; i++) {
-		entry[i].offset = le32toh(entry[i].offset);
-		entry[i].size = le32toh(entry[i].size);
+	for (i = 0; i < le32toh(dir->count); i++) {
+		uint32_t offset = le32toh(entry[i].offset);
+		uint32_t length = le32toh(entry[i].size);
+
+		if (offset < get_first_offset(dir) || offset > size ||
+		    length > size - offset) {
+			printf("%s: '%.*s' has invalid offset or size\n",
+			       __func__, NAME_LENGTH, entry[i].name);
+			goto fail;
+		}
 	}
 
 	*dest = dir;
 
 	return VBERROR_SUCCESS;
+
+fail:
+	cbfs_unmap_file(dir);
+	return VBERROR_INVALID_BMPFV;
 }
 
 static VbError_t load_localized_graphics(uint32_t locale)
@@ -164,7 +184,7 @@ static VbError_t load_localized_graphics(uint32_t locale)
 		if (locale_data.archive_locale == locale)
 			return VBERROR_SUCCESS;
 		/* No need to keep more than one locale graphics at a time */
-		free(locale_data.archive);
+		cbfs_unmap_file(locale_data.archive);
 	}
 
 	/* compose archive name using the language code */
@@ -177,11 +197,10 @@ static VbError_t load_localized_graphics(uint32_t locale)
 	return VBERROR_SUCCESS;
 }
 
-static struct dentry *find_file_in_archive(const struct directory *dir,
-					   const char *name)
+static const struct dentry *find_file_in_archive(const struct directory *dir,
+						 const char *name)
 {
-	struct dentry *entry;
-	uintptr_t start;
+	const struct dentry *entry;
 	int i;
 
 	if (!dir) {
@@ -189,22 +208,11 @@ static struct dentry *find_file_in_archive(const struct directory *dir,
 		return NULL;
 	}
 
-	/* calculate start of the file content section */
-	start = get_first_offset(dir);
+	/* offsets and sizes were validated by load_archive */
 	entry = get_first_dentry(dir);
-	for (i = 0; i < dir->count; i++) {
-		if (strncmp(entry[i].name, name, NAME_LENGTH))
-			continue;
-		/* validate offset & size */
-		if (entry[i].offset < start
-				|| entry[i].offset + entry[i].size > dir->size
-				|| entry[i].offset > dir->size
-				|| entry[i].size > dir->size) {
-			printf("%s: '%s' has invalid offset or size\n",
-			       __func__, name);
-			return NULL;
-		}
-		return &entry[i];
+	for (i = 0; i < le32toh(dir->count); i++) {
+		if (!strncmp(entry[i].name, name, NAME_LENGTH))
+			return &entry[i];
 	}
 
 	printf("%s: file '%s' not found\n", __func__, name);
@@ -213,20 +221,13 @@ static struct dentry *find_file_in_archive(const struct directory *dir,
 }
 
 /*
- * Find and draw image in archive
+ * Draw an image which has already been found in an archive
  */
-static VbError_t draw(struct directory *dir, const char *image_name,
-		      int32_t x, int32_t y, int32_t width, int32_t height,
-		      uint32_t flags)
+static VbError_t draw_found(const void *bitmap, uint32_t size,
+			    const char *image_name,
+			    int32_t x, int32_t y, int32_t width, int32_t height,
+			    uint32_t flags)
 {
-	struct dentry *file;
-	void *bitmap;
-
-	file = find_file_in_archive(dir, image_name);
-	if (!file)
-		return VBERROR_NO_IMAGE_PRESENT;
-	bitmap = (uint8_t *)dir + file->offset;
-
 	struct scale pos = {
 		.x = { .n = x, .d = VB_SCALE, },
 		.y = { .n = y, .d = VB_SCALE, },
@@ -236,12 +237,11 @@ static VbError_t draw(struct directory *dir, const char *image_name,
 		.y = { .n = height, .d = VB_SCALE, },
 	};
 
-	if (get_bitmap_dimension(bitmap, file->size, &dim))
+	if (get_bitmap_dimension(bitmap, size, &dim))
 		return VBERROR_UNKNOWN;
 
 	if ((int64_t)dim.x.n * VB_SCALE <= (int64_t)dim.x.d * VB_DIVIDER_WIDTH)
-		return draw_bitmap((uint8_t *)dir + file->offset, file->size,
-				   &pos, &dim, flags);
+		return draw_bitmap(bitmap, size, &pos, &dim, flags);
 
 	/*
 	 * If we get here the image is too wide, so fit it to the content width.
@@ -255,8 +255,25 @@ static VbError_t draw(struct directory *dir, const char *image_name,
 	dim.x.d = VB_SCALE;
 	dim.y.n = VB_SIZE_AUTO;
 	dim.y.d = VB_SCALE;
-	return draw_bitmap((uint8_t *)dir + file->offset, file->size,
-			   &pos, &dim, flags);
+	return draw_bitmap(bitmap, size, &pos, &dim, flags);
+}
+
+/*
+ * Find and draw image in archive
+ */
+static VbError_t draw(struct directory *dir, const char *image_name,
+		      int32_t x, int32_t y, int32_t width, int32_t height,
+		      uint32_t flags)
+{
+	const struct dentry *file;
+
+	file = find_file_in_archive(dir, image_name);
+	if (!file)
+		return VBERROR_NO_IMAGE_PRESENT;
+
+	return draw_found((uint8_t *)dir + le32toh(file->offset),
+			  le32toh(file->size), image_name,
+			  x, y, width, height, flags);
 }
 
 static VbError_t draw_image(const char *image_name,
@@ -274,24 +291,15 @@ static VbError_t draw_image_locale(const char *image_name, uint32_t locale,
 	return draw(locale_data.archive, image_name, x, y, w, h, flags);
 }
 
-static VbError_t get_image_size(struct directory *dir, const char *image_name,
+static VbError_t get_found_size(const void *bitmap, uint32_t size,
 				int32_t *width, int32_t *height)
 {
-	struct dentry *file;
-	VbError_t rv;
-
-	file = find_file_in_archive(dir, image_name);
-	if (!file)
-		return VBERROR_NO_IMAGE_PRESENT;
-
 	struct scale dim = {
 		.x = { .n = *width, .d = VB_SCALE, },
 		.y = { .n = *height, .d = VB_SCALE, },
 	};
 
-	rv = get_bitmap_dimension((uint8_t *)dir + file->offset,
-				  file->size, &dim);
-	if (rv)
+	if (get_bitmap_dimension(bitmap, size, &dim))
 		return VBERROR_UNKNOWN;
 
 	*width = dim.x.n * VB_SCALE / dim.x.d;
@@ -300,6 +308,19 @@ static VbError_t get_image_size(struct directory *dir, const char *image_name,
 	return VBERROR_SUCCESS;
 }
 
+static VbError_t get_image_size(struct directory *dir, const char *image_name,
+				int32_t *width, int32_t *height)
+{
+	const struct dentry *file;
+
+	file = find_file_in_archive(dir, image_name);
+	if (!file)
+		return VBERROR_NO_IMAGE_PRESENT;
+
+	return get_found_size((uint8_t *)dir + le32toh(file->offset),
+			      le32toh(file->size), width, height);
+}
+
 static VbError_t get_image_size_locale(const char *image_name, uint32_t locale,
 				       int32_t *width, int32_t *height)
 {
@@ -315,18 +336,62 @@ static int draw_icon(const char *image_name)
 			  PIVOT_H_CENTER|PIVOT_V_BOTTOM);
 }
 
+/*
+ * Look up the glyph for a character and its width at the given height,
+ * going to the font archive only the first time either is needed.
+ */
+static VbError_t get_glyph(char c, int32_t height, const char **name,
+			   const void **bitmap, uint32_t *size, int32_t *width)
+{
+	unsigned char index = c;
+
+	if (index >= ARRAY_SIZE(glyphs)) {
+		printf("%s: no glyph for character %#x\n", __func__, index);
+		return VBERROR_NO_IMAGE_PRESENT;
+	}
+
+	if (!glyphs[index].bitmap) {
+		const struct dentry *file;
+
+		snprintf(glyphs[index].name, sizeof(glyphs[index].name),
+			 "idx%03d_%02x.bmp", c, c);
+		file = find_file_in_archive(font_graphics, glyphs[index].name);
+		if (!file)
+			return VBERROR_NO_IMAGE_PRESENT;
+		glyphs[index].bitmap =
+			(uint8_t *)font_graphics + le32toh(file->offset);
+		glyphs[index].size = le32toh(file->size);
+		glyphs[index].height = 0;
+	}
+
+	if (glyphs[index].height != height) {
+		int32_t w = 0, h = height;
+
+		RETURN_ON_ERROR(get_found_size(glyphs[index].bitmap,
+					       glyphs[index].size, &w, &h));
+		glyphs[index].width = w;
+		glyphs[index].height = height;
+	}
+
+	*name = glyphs[index].name;
+	*bitmap = glyphs[index].bitmap;
+	*size = glyphs[index].size;
+	*width = glyphs[index].width;
+	return VBERROR_SUCCESS;
+}
+
 static int draw_text(const char *text, int32_t x, int32_t y,
 		     int32_t height, char pivot)
 {
-	int32_t w, h;
-	char str[256];
+	const char *name;
+	const void *bitmap;
+	uint32_t size;
+	int32_t w;
 	while (*text) {
-		sprintf(str, "idx%03d_%02x.bmp", *text, *text);
-		w = 0;
-		h = height;
-		RETURN_ON_ERROR(get_image_size(font_graphics, str, &w, &h));
-		RETURN_ON_ERROR(draw(font_graphics, str,
-				     x, y, VB_SIZE_AUTO, height, pivot));
+		RETURN_ON_ERROR(get_glyph(*text, height, &name, &bitmap, &size,
+					  &w));
+		RETURN_ON_ERROR(draw_found(bitmap, size, name, x, y,
+					   VB_SIZE_AUTO, height, pivot));
 		x += w;
 		text++;
 	}
@@ -335,13 +400,13 @@ static int draw_text(const char *text, int32_t x, int32_t y,
 
 static int get_text_width(const char *text, int32_t *width, int32_t *height)
 {
-	int32_t w, h;
-	char str[256];
+	const char *name;
+	const void *bitmap;
+	uint32_t size;
+	int32_t w;
 	while (*text) {
-		sprintf(str, "idx%03d_%02x.bmp", *text, *text);
-		w = 0;
-		h = *height;
-		RETURN_ON_ERROR(get_image_size(font_graphics, str, &w, &h));
+		RETURN_ON_ERROR(get_glyph(*text, *height, &name, &bitmap,
+					  &size, &w));
 		*width += w;
 		text++;
 	}
@@ -1143,14 +1208,14 @@ static VbError_t draw_ui(uint32_t screen_type, struct params *p)
 
 static void vboot_init_locale(void)
 {
-	char *locales, *loc_start, *loc;
+	const char *locales;
+	char *loc_start, *loc;
 	size_t size;
 
 	locale_data.count = 0;
 
-	/* Load locale list from cbfs */
-	locales = cbfs_get_file_content(ro_cbfs, "locales",
-					CBFS_TYPE_RAW, &size);
+	/* Map locale list from cbfs */
+	locales = cbfs_map_file(ro_cbfs, "locales", CBFS_TYPE_RAW, &size);
 	if (!locales || !size) {
 		printf("%s: locale list not found\n", __func__);
 		return;
@@ -1160,7 +1225,7 @@ static void vboot_init_locale(void)
 	loc_start = malloc(size + 1);
 	if (!loc_start) {
 		printf("%s: out of memory\n", __func__);
-		free(locales);
+		cbfs_unmap_file(locales);
 		return;
 	}
 	memcpy(loc_start, locales, size);
@@ -1178,7 +1243,7 @@ static void vboot_init_locale(void)
 		locale_data.codes[locale_data.count] = lang;
 		locale_data.count++;
 	}
-	free(locales);
+	cbfs_unmap_file(locales);
 
 	printf(" (%d locales)\n", locale_data.count);
 }
@@ -18,6 +18,7 @@
 #include <assert.h>
 
 #include "base/list.h"
+#include "base/profile.h"
 #include "vboot/util/init_funcs.h"
 
 ListNode vboot_init_funcs;
@@ -27,7 +28,10 @@ int run_vboot_init_funcs(void)
 	VbootInitFunc *init_func;
 	list_for_each(init_func, vboot_init_funcs, list_node) {
 		assert(init_func->init);
-		if (init_func->init(init_func))
+		int span = profile_begin("vboot init", init_func->init);
+		int res = init_func->init(init_func);
+		profile_end(span);
+		if (res)
 			return 1;
 	}
 	return 0;
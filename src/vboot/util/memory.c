@@ -20,8 +20,9 @@
 #include <stdint.h>
 #include <sysinfo.h>
 
-#include "base/ranges.h"
 #include "base/physmem.h"
+#include "base/profile.h"
+#include "base/ranges.h"
 #include "image/symbols.h"
 #include "vboot/util/memory.h"
 
@@ -47,18 +48,40 @@ void memory_mark_used(uint64_t start, uint64_t end)
 	ranges_add(&used, start, end);
 }
 
+static void remove_range(uint64_t start, uint64_t end, void *data)
+{
+	ranges_sub((Ranges *)data, start, end);
+}
 
-static void unused_memset(uint64_t start, uint64_t end, void *data)
+void memory_remove_used(Ranges *ranges)
 {
-	printf("\t[%#016llx, %#016llx)\n", start, end);
-	arch_phys_memset(start, 0, end - start);
+	used_list_initialize();
+	ranges_for_each(&used, &remove_range, ranges);
 }
 
-static void remove_range(uint64_t start, uint64_t end, void *data)
+
+typedef struct {
+	uint64_t bytes;
+	uint64_t us;
+} WipeStats;
+
+static void unused_memset(uint64_t start, uint64_t end, void *data)
 {
-	ranges_sub((Ranges *)data, start, end);
+	WipeStats *stats = data;
+	uint64_t begin = timer_us(0);
+	uint64_t us;
+
+	printf("\t[%#016llx, %#016llx)", start, end);
+	arch_phys_memset(start, 0, end - start);
+	us = timer_us(begin);
+	printf(" %lld MiB in %lld ms, %lld MB/s\n", (end - start) / MiB,
+	       us / 1000, profile_mbps(end - start, us));
+
+	stats->bytes += end - start;
+	stats->us += us;
 }
 
+
 int memory_wipe_unused(void)
 {
 	Ranges ranges;
@@ -89,12 +112,14 @@ int memory_wipe_unused(void)
 	}
 
 	// Exclude memory that's being used.
-	used_list_initialize();
-	ranges_for_each(&used, &remove_range, &ranges);
+	memory_remove_used(&ranges);
 
 	// Do the wipe.
+	WipeStats stats = { 0 };
 	printf("Wipe memory regions:\n");
-	ranges_for_each(&ranges, &unused_memset, NULL);
+	ranges_for_each(&ranges, &unused_memset, &stats);
 	ranges_teardown(&ranges);
+	printf("Wiped %lld MiB in %lld ms, %lld MB/s\n", stats.bytes / MiB,
+	       stats.us / 1000, profile_mbps(stats.bytes, stats.us));
 	return 0;
 }
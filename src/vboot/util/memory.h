@@ -20,7 +20,11 @@
 
 #include <stdint.h>
 
+#include "base/ranges.h"
+
 int memory_wipe_unused(void);
 void memory_mark_used(uint64_t start, uint64_t end);
+// Remove depthcharge itself and everything passed to memory_mark_used().
+void memory_remove_used(Ranges *ranges);
 
 #endif /* __VBOOT_UTIL_MEMORY_H__ */